@@ -4,6 +4,66 @@
 #include <stdio.h>
 #include "devices/ide.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Request queues.
+
+   Requests for a whole disk, that is, a device that its driver
+   registered as BLOCK_RAW, pass through a queue and are issued
+   to the driver by the device's own dispatch thread.  Other
+   devices, such as partitions, are views onto a whole disk and
+   pass their requests straight to their driver, which queues
+   them on the disk underneath.
+
+   Pending reads and writes are kept in separate lists, each
+   sorted by sector.  The dispatcher serves them in C-SCAN order:
+   it takes the first request at or past the sector where the
+   previous one ended, wrapping around to the lowest sector when
+   there is none, and merges the requests that continue it
+   without a gap into a single driver request.
+
+   Reads are served before writes, since a reader is waiting for
+   the data while most writes come from the buffer cache's
+   background write-back.  To keep writes from starving, one
+   write is dispatched after every READ_BATCH reads while writes
+   are waiting. */
+#define READ_BATCH 8
+
+/* Most buffers and sectors that merging may combine into one
+   driver request. */
+#define MERGE_MAX_IOV 64
+#define MERGE_MAX_SECTORS 256
+
+/* A request waiting in a queue. */
+struct block_request
+  {
+    struct list_elem elem;              /* Element in a queue list. */
+    block_sector_t sector;              /* First sector. */
+    size_t sector_cnt;                  /* Number of sectors. */
+    const struct block_iovec *iov;      /* Buffers. */
+    size_t iov_cnt;                     /* Number of buffers. */
+    struct semaphore done;              /* Up'd once completed. */
+  };
+
+/* A block device's request queue. */
+struct block_queue
+  {
+    struct lock lock;                   /* Protects the members below. */
+    struct condition nonempty;          /* Signaled when a request arrives. */
+    struct list reads;                  /* Pending reads, by sector. */
+    struct list writes;                 /* Pending writes, by sector. */
+    size_t depth;                       /* Number of pending requests. */
+    block_sector_t head;                /* Sector after last dispatch. */
+    int read_streak;                    /* Reads dispatched in a row. */
+
+    /* Statistics. */
+    unsigned long long request_cnt;     /* Requests queued. */
+    unsigned long long dispatch_cnt;    /* Driver requests issued. */
+    unsigned long long merge_cnt;       /* Requests merged into others. */
+    unsigned long long depth_sum;       /* Sum of depths seen on arrival. */
+    size_t max_depth;                   /* Greatest depth. */
+  };
 
 /* A block device. */
 struct block
@@ -19,6 +79,10 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long hit_cnt;         /* Number of cache hits. */
+    unsigned long long miss_cnt;        /* Number of cache misses. */
+
+    struct block_queue *queue;          /* Request queue, or null. */
   };
 
 /* List of all block devices. */
@@ -28,6 +92,11 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void submit (struct block *, block_sector_t,
+                    const struct block_iovec *, size_t iov_cnt, bool write);
+static void do_io (struct block *, block_sector_t,
+                   const struct block_iovec *, size_t iov_cnt, bool write);
+static void dispatch (void *block_);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,8 +189,12 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
+  struct block_iovec iov;
+
   check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
+  iov.buffer = buffer;
+  iov.sector_cnt = 1;
+  submit (block, sector, &iov, 1, false);
   block->read_cnt++;
 }
 
@@ -133,12 +206,227 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
+  struct block_iovec iov;
+
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
+  iov.buffer = (void *) buffer;
+  iov.sector_cnt = 1;
+  submit (block, sector, &iov, 1, true);
   block->write_cnt++;
 }
 
+/* Returns the total number of sectors in the IOV_CNT buffers in
+   IOV. */
+static size_t
+iovec_sectors (const struct block_iovec *iov, size_t iov_cnt)
+{
+  size_t cnt = 0;
+  size_t i;
+
+  for (i = 0; i < iov_cnt; i++)
+    cnt += iov[i].sector_cnt;
+  return cnt;
+}
+
+/* Reads consecutive sectors of BLOCK, starting at SECTOR, into
+   the IOV_CNT buffers in IOV, filling each buffer in turn.  Uses
+   a single driver request when the driver supports it.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multi (struct block *block, block_sector_t sector,
+                  const struct block_iovec *iov, size_t iov_cnt)
+{
+  size_t cnt = iovec_sectors (iov, iov_cnt);
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  submit (block, sector, iov, iov_cnt, false);
+  block->read_cnt += cnt;
+}
+
+/* Writes consecutive sectors of BLOCK, starting at SECTOR, from
+   the IOV_CNT buffers in IOV, taking each buffer in turn.  Uses
+   a single driver request when the driver supports it.  Returns
+   after the block device has acknowledged receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multi (struct block *block, block_sector_t sector,
+                   const struct block_iovec *iov, size_t iov_cnt)
+{
+  size_t cnt = iovec_sectors (iov, iov_cnt);
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  submit (block, sector, iov, iov_cnt, true);
+  block->write_cnt += cnt;
+}
+
+/* Reads (if WRITE is false) or writes (if WRITE is true)
+   consecutive sectors of BLOCK, starting at SECTOR, using the
+   IOV_CNT buffers in IOV.  Goes through BLOCK's queue, if it has
+   one, waiting until the request completes. */
+static void
+submit (struct block *block, block_sector_t sector,
+        const struct block_iovec *iov, size_t iov_cnt, bool write)
+{
+  struct block_queue *q = block->queue;
+  struct block_request r;
+  struct list *list;
+  struct list_elem *e;
+
+  if (q == NULL)
+    {
+      do_io (block, sector, iov, iov_cnt, write);
+      return;
+    }
+
+  r.sector = sector;
+  r.sector_cnt = iovec_sectors (iov, iov_cnt);
+  r.iov = iov;
+  r.iov_cnt = iov_cnt;
+  sema_init (&r.done, 0);
+
+  lock_acquire (&q->lock);
+  list = write ? &q->writes : &q->reads;
+  for (e = list_begin (list); e != list_end (list); e = list_next (e))
+    if (list_entry (e, struct block_request, elem)->sector > sector)
+      break;
+  list_insert (e, &r.elem);
+  q->depth++;
+  q->request_cnt++;
+  q->depth_sum += q->depth;
+  if (q->depth > q->max_depth)
+    q->max_depth = q->depth;
+  cond_signal (&q->nonempty, &q->lock);
+  lock_release (&q->lock);
+
+  sema_down (&r.done);
+}
+
+/* Performs the transfer described for submit() by calling
+   BLOCK's driver directly. */
+static void
+do_io (struct block *block, block_sector_t sector,
+       const struct block_iovec *iov, size_t iov_cnt, bool write)
+{
+  size_t i, j;
+
+  if (write && block->ops->write_multi != NULL)
+    block->ops->write_multi (block->aux, sector, iov, iov_cnt);
+  else if (!write && block->ops->read_multi != NULL)
+    block->ops->read_multi (block->aux, sector, iov, iov_cnt);
+  else
+    for (i = 0; i < iov_cnt; i++)
+      for (j = 0; j < iov[i].sector_cnt; j++)
+        {
+          uint8_t *buffer = (uint8_t *) iov[i].buffer + j * BLOCK_SECTOR_SIZE;
+          if (write)
+            block->ops->write (block->aux, sector++, buffer);
+          else
+            block->ops->read (block->aux, sector++, buffer);
+        }
+}
+
+/* Returns the request in LIST, which is sorted by sector, that
+   C-SCAN serves next after HEAD: the first at or after HEAD, or
+   the first of all if there is none. */
+static struct block_request *
+cscan_next (struct list *list, block_sector_t head)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (list); e != list_end (list); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->sector >= head)
+        return r;
+    }
+  return list_entry (list_begin (list), struct block_request, elem);
+}
+
+/* Dispatch thread for BLOCK_, a block device with a queue.
+   Repeatedly takes the next request from the queue, merges it
+   with those that follow it on disk, and carries them out. */
+static void
+dispatch (void *block_)
+{
+  struct block *block = block_;
+  struct block_queue *q = block->queue;
+
+  for (;;)
+    {
+      struct block_request *batch[MERGE_MAX_IOV];
+      struct block_iovec iov[MERGE_MAX_IOV];
+      struct block_request *r;
+      struct list *list;
+      size_t batch_cnt, iov_cnt, sector_cnt;
+      bool write;
+      size_t i, j;
+
+      /* Choose reads or writes. */
+      lock_acquire (&q->lock);
+      while (list_empty (&q->reads) && list_empty (&q->writes))
+        cond_wait (&q->nonempty, &q->lock);
+      write = (list_empty (&q->reads)
+               || (!list_empty (&q->writes) && q->read_streak >= READ_BATCH));
+      q->read_streak = (write || list_empty (&q->writes)
+                        ? 0 : q->read_streak + 1);
+      list = write ? &q->writes : &q->reads;
+
+      /* Take the next request, and the ones that continue it. */
+      r = cscan_next (list, q->head);
+      batch[0] = r;
+      batch_cnt = 1;
+      iov_cnt = r->iov_cnt;
+      sector_cnt = r->sector_cnt;
+      for (;;)
+        {
+          struct list_elem *e = list_next (&batch[batch_cnt - 1]->elem);
+          struct block_request *next;
+
+          if (e == list_end (list) || batch_cnt >= MERGE_MAX_IOV)
+            break;
+          next = list_entry (e, struct block_request, elem);
+          if (next->sector != r->sector + sector_cnt
+              || iov_cnt + next->iov_cnt > MERGE_MAX_IOV
+              || sector_cnt + next->sector_cnt > MERGE_MAX_SECTORS)
+            break;
+          batch[batch_cnt++] = next;
+          iov_cnt += next->iov_cnt;
+          sector_cnt += next->sector_cnt;
+        }
+      for (i = 0; i < batch_cnt; i++)
+        list_remove (&batch[i]->elem);
+      q->depth -= batch_cnt;
+      q->dispatch_cnt++;
+      q->merge_cnt += batch_cnt - 1;
+      q->head = r->sector + sector_cnt;
+      lock_release (&q->lock);
+
+      /* Carry out the merged request. */
+      if (batch_cnt == 1)
+        do_io (block, r->sector, r->iov, r->iov_cnt, write);
+      else
+        {
+          iov_cnt = 0;
+          for (i = 0; i < batch_cnt; i++)
+            for (j = 0; j < batch[i]->iov_cnt; j++)
+              iov[iov_cnt++] = batch[i]->iov[j];
+          do_io (block, r->sector, iov, iov_cnt, write);
+        }
+      for (i = 0; i < batch_cnt; i++)
+        sema_up (&batch[i]->done);
+    }
+}
+
 /* Returns the number of sectors in BLOCK. */
 block_sector_t
 block_size (struct block *block)
@@ -160,10 +448,22 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Counts an access to BLOCK by a cache in front of it, as a
+   hit if HIT is true or as a miss otherwise. */
+void
+block_count_cache (struct block *block, bool hit)
+{
+  if (hit)
+    block->hit_cnt++;
+  else
+    block->miss_cnt++;
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -174,6 +474,28 @@ block_print_stats (void)
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          if (block->hit_cnt + block->miss_cnt > 0)
+            printf ("%s (%s): %llu cache hits, %llu misses "
+                    "(%llu%% hit rate)\n",
+                    block->name, block_type_name (block->type),
+                    block->hit_cnt, block->miss_cnt,
+                    block->hit_cnt * 100 / (block->hit_cnt + block->miss_cnt));
+        }
+    }
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      struct block_queue *q = block->queue;
+      if (q != NULL && q->request_cnt > 0)
+        {
+          unsigned long long avg_depth10 = q->depth_sum * 10 / q->request_cnt;
+          printf ("%s: %llu requests, %llu dispatched, %llu merged, "
+                  "queue depth %llu.%llu average, %zu max\n",
+                  block->name, q->request_cnt, q->dispatch_cnt,
+                  q->merge_cnt, avg_depth10 / 10, avg_depth10 % 10,
+                  q->max_depth);
         }
     }
 }
@@ -182,7 +504,9 @@ block_print_stats (void)
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
    be provided, as well as the it operation functions OPS, which
-   will be passed AUX in each function call. */
+   will be passed AUX in each function call.  A device of type
+   BLOCK_RAW, which is a whole disk, gets a request queue and a
+   thread to dispatch from it. */
 struct block *
 block_register (const char *name, enum block_type type,
                 const char *extra_info, block_sector_t size,
@@ -200,6 +524,24 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->hit_cnt = 0;
+  block->miss_cnt = 0;
+  block->queue = NULL;
+  if (type == BLOCK_RAW)
+    {
+      struct block_queue *q = calloc (1, sizeof *q);
+      char thread_name[3 + sizeof block->name];
+
+      if (q == NULL)
+        PANIC ("Failed to allocate memory for block device queue");
+      lock_init (&q->lock);
+      cond_init (&q->nonempty);
+      list_init (&q->reads);
+      list_init (&q->writes);
+      block->queue = q;
+      snprintf (thread_name, sizeof thread_name, "io-%s", block->name);
+      thread_create (thread_name, PRI_DEFAULT, dispatch, block);
+    }
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
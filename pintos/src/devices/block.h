@@ -1,6 +1,7 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
 
@@ -22,6 +23,14 @@ typedef uint32_t block_sector_t;
 
 struct block;
 
+/* One buffer in a multi-sector transfer: SECTOR_CNT sectors of
+   BLOCK_SECTOR_SIZE bytes each, starting at BUFFER. */
+struct block_iovec
+  {
+    void *buffer;
+    size_t sector_cnt;
+  };
+
 /* Type of a block device. */
 enum block_type
   {
@@ -53,18 +62,31 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, block_sector_t,
+                       const struct block_iovec *, size_t iov_cnt);
+void block_write_multi (struct block *, block_sector_t,
+                        const struct block_iovec *, size_t iov_cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
 /* Statistics. */
+void block_count_cache (struct block *, bool hit);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
 
+/* READ_MULTI and WRITE_MULTI transfer consecutive sectors,
+   starting at the given sector, to or from the buffers in an
+   array of IOV_CNT struct block_iovec.  Drivers that cannot do
+   better than one sector at a time may leave them null. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multi) (void *aux, block_sector_t,
+                        const struct block_iovec *, size_t iov_cnt);
+    void (*write_multi) (void *aux, block_sector_t,
+                         const struct block_iovec *, size_t iov_cnt);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -3,12 +3,15 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/block.h"
 #include "devices/partition.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,6 +37,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +53,41 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Bus master IDE port addresses, relative to a channel's
+   BMI_BASE. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bmi_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bmi_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bmi_base + 4)    /* PRD table. */
+
+/* Bus Master Command Register bits. */
+#define BMC_START 0x01          /* Start transfer. */
+#define BMC_READ 0x08           /* Transfer from disk to memory. */
+
+/* Bus Master Status Register bits. */
+#define BMS_ERR 0x02            /* Transfer failed (write 1 to clear). */
+#define BMS_INTR 0x04           /* Interrupt raised (write 1 to clear). */
+
+/* A physical region descriptor, one element of the table that
+   tells the bus master where to move data. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address of region. */
+    uint16_t size;              /* Size in bytes, 0 means 65536. */
+    uint16_t flags;             /* PRD_EOT on the last descriptor. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
+#define PRD_BOUNDARY 0x10000    /* A region may not cross 64 kB. */
+
+/* Most sectors moved by one READ or WRITE command.  A sector
+   count register value of 0 means 256. */
+#define MAX_TRANSFER 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +96,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt in READ/WRITE
+                                   MULTIPLE, or 0 if not supported. */
+    bool dma;                   /* Use bus-master DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -72,6 +114,9 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bmi_base;          /* Bus master I/O port, 0 if none. */
+    struct prd *prdt;           /* PRD table, if BMI_BASE is nonzero. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -79,13 +124,32 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* -pio: Use programmed I/O even if bus-master DMA is available. */
+bool ide_pio_only;
+
 static struct block_operations ide_operations;
 
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
-
-static void select_sector (struct ata_disk *, block_sector_t);
+static void set_multiple_mode (struct ata_disk *, int max);
+static uint16_t find_bus_master (void);
+
+static void ide_read_multi (void *, block_sector_t,
+                            const struct block_iovec *, size_t iov_cnt);
+static void ide_write_multi (void *, block_sector_t,
+                             const struct block_iovec *, size_t iov_cnt);
+static void pio_read (struct ata_disk *, block_sector_t,
+                      const struct block_iovec *, size_t iov_cnt);
+static void pio_write (struct ata_disk *, block_sector_t,
+                       const struct block_iovec *, size_t iov_cnt);
+static bool can_dma (const struct ata_disk *,
+                     const struct block_iovec *, size_t iov_cnt);
+static void dma_transfer (struct ata_disk *, block_sector_t,
+                          const struct block_iovec *, size_t iov_cnt,
+                          bool write);
+
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -101,6 +165,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void)
 {
+  uint16_t bmi_base = ide_pio_only ? 0 : find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,6 +191,8 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bmi_base = bmi_base != 0 ? bmi_base + chan_no * 8 : 0;
+      c->prdt = c->bmi_base != 0 ? palloc_get_page (PAL_ASSERT) : NULL;
 
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +203,7 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -303,12 +371,106 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Use READ/WRITE MULTIPLE if the disk supports it, and DMA if
+     both it and the channel do. */
+  set_multiple_mode (d, (uint8_t) id[47 * 2]);
+  d->dma = c->bmi_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100) != 0;
+  if (d->dma)
+    snprintf (extra_info + strlen (extra_info),
+              sizeof extra_info - strlen (extra_info), ", DMA");
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
   partition_scan (block);
 }
 
+/* Enables READ/WRITE MULTIPLE on disk D, transferring the
+   largest power of 2 sectors per interrupt that does not exceed
+   MAX, the limit reported by IDENTIFY DEVICE.  Leaves D's
+   MULTIPLE at 0 if MAX is less than 2 or the disk refuses. */
+static void
+set_multiple_mode (struct ata_disk *d, int max)
+{
+  struct channel *c = d->channel;
+  int cnt;
+
+  d->multiple = 0;
+  if (max < 2)
+    return;
+  for (cnt = 2; cnt * 2 <= max; cnt *= 2)
+    continue;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_status (c)) & STA_ERR) == 0)
+    d->multiple = cnt;
+}
+
+/* PCI configuration space access, mechanism #1. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Returns the 32-bit register at byte offset REG in the
+   configuration space of PCI function FN of device DEV on bus
+   0. */
+static uint32_t
+pci_read_config (int dev, int fn, int reg)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (fn << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Sets the 32-bit register at byte offset REG in the
+   configuration space of PCI function FN of device DEV on bus 0
+   to VALUE. */
+static void
+pci_write_config (int dev, int fn, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (fn << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller capable of bus-master
+   DMA, such as the PIIX emulated by QEMU and Bochs.  If one is
+   found, enables it to master the bus and returns the base of its
+   bus master I/O ports, which covers the primary channel and,
+   8 ports later, the secondary channel.  Otherwise, returns 0. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, fn;
+
+  for (dev = 0; dev < 32; dev++)
+    for (fn = 0; fn < 8; fn++)
+      {
+        uint32_t class, bar4;
+
+        if ((pci_read_config (dev, fn, 0x00) & 0xffff) == 0xffff)
+          continue;
+
+        /* Class 01h (mass storage), subclass 01h (IDE), with
+           programming interface bit 7 set (bus master). */
+        class = pci_read_config (dev, fn, 0x08);
+        if ((class >> 16) != 0x0101 || !(class & 0x8000))
+          continue;
+
+        /* BAR4 must be an I/O port range. */
+        bar4 = pci_read_config (dev, fn, 0x20);
+        if (!(bar4 & 1) || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space and bus mastering. */
+        pci_write_config (dev, fn, 0x04,
+                          (pci_read_config (dev, fn, 0x04) & 0xffff) | 0x05);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -344,16 +506,11 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  struct block_iovec iov;
+
+  iov.buffer = buffer;
+  iov.sector_cnt = 1;
+  ide_read_multi (d_, sec_no, &iov, 1);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -363,37 +520,313 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
    per-disk locking is unneeded. */
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  struct block_iovec iov;
+
+  iov.buffer = (void *) buffer;
+  iov.sector_cnt = 1;
+  ide_write_multi (d_, sec_no, &iov, 1);
+}
+
+/* Reads consecutive sectors of disk D, starting at SEC_NO, into
+   the IOV_CNT buffers in IOV, by DMA if possible and otherwise
+   by PIO.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multi (void *d_, block_sector_t sec_no,
+                const struct block_iovec *iov, size_t iov_cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  if (can_dma (d, iov, iov_cnt))
+    dma_transfer (d, sec_no, iov, iov_cnt, false);
+  else
+    pio_read (d, sec_no, iov, iov_cnt);
+  lock_release (&c->lock);
+}
+
+/* Writes consecutive sectors of disk D, starting at SEC_NO, from
+   the IOV_CNT buffers in IOV, by DMA if possible and otherwise
+   by PIO.  Returns after the disk has acknowledged receiving the
+   data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multi (void *d_, block_sector_t sec_no,
+                 const struct block_iovec *iov, size_t iov_cnt)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+
+  lock_acquire (&c->lock);
+  if (can_dma (d, iov, iov_cnt))
+    dma_transfer (d, sec_no, iov, iov_cnt, true);
+  else
+    pio_write (d, sec_no, iov, iov_cnt);
   lock_release (&c->lock);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multi,
+    ide_write_multi
+  };
+
+/* A position in a scatter-gather list. */
+struct iov_cursor
+  {
+    const struct block_iovec *iov;      /* Current buffer. */
+    size_t sector;                      /* Next sector within it. */
   };
+
+/* Returns the next sector's worth of buffer at cursor C and
+   advances C past it. */
+static uint8_t *
+iov_next (struct iov_cursor *c)
+{
+  uint8_t *buffer;
+
+  while (c->sector >= c->iov->sector_cnt)
+    {
+      c->iov++;
+      c->sector = 0;
+    }
+  buffer = (uint8_t *) c->iov->buffer + c->sector * BLOCK_SECTOR_SIZE;
+  c->sector++;
+  return buffer;
+}
+
+/* Returns the total number of sectors in the IOV_CNT buffers in
+   IOV. */
+static size_t
+iov_sectors (const struct block_iovec *iov, size_t iov_cnt)
+{
+  size_t cnt = 0;
+  size_t i;
+
+  for (i = 0; i < iov_cnt; i++)
+    cnt += iov[i].sector_cnt;
+  return cnt;
+}
+
+/* Returns the number of sectors to move before the next
+   interrupt in a transfer of CNT sectors on disk D that has
+   already moved DONE of them. */
+static size_t
+drq_block_size (const struct ata_disk *d, size_t cnt, size_t done)
+{
+  size_t block = d->multiple > 0 ? (size_t) d->multiple : 1;
+  return block < cnt - done ? block : cnt - done;
+}
+
+/* Reads consecutive sectors of disk D, starting at SEC_NO, into
+   the IOV_CNT buffers in IOV by PIO, using as few commands as
+   possible: each command moves up to MAX_TRANSFER sectors, with
+   one interrupt per D->MULTIPLE sectors if D supports READ
+   MULTIPLE or per sector otherwise.
+   D's channel must be locked. */
+static void
+pio_read (struct ata_disk *d, block_sector_t sec_no,
+          const struct block_iovec *iov, size_t iov_cnt)
+{
+  struct channel *c = d->channel;
+  struct iov_cursor cur = { iov, 0 };
+  size_t left = iov_sectors (iov, iov_cnt);
+  size_t i;
+
+  while (left > 0)
+    {
+      size_t cnt = left < MAX_TRANSFER ? left : MAX_TRANSFER;
+      size_t done = 0;
+
+      select_sector (d, sec_no, cnt);
+      issue_pio_command (c, (d->multiple > 0 ? CMD_READ_MULTIPLE
+                             : CMD_READ_SECTOR_RETRY));
+      while (done < cnt)
+        {
+          size_t block = drq_block_size (d, cnt, done);
+
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + done);
+          for (i = 0; i < block; i++)
+            input_sector (c, iov_next (&cur));
+          done += block;
+        }
+      sec_no += cnt;
+      left -= cnt;
+    }
+}
+
+/* Writes consecutive sectors of disk D, starting at SEC_NO, from
+   the IOV_CNT buffers in IOV by PIO, using as few commands as
+   possible, as pio_read() does.
+   D's channel must be locked. */
+static void
+pio_write (struct ata_disk *d, block_sector_t sec_no,
+           const struct block_iovec *iov, size_t iov_cnt)
+{
+  struct channel *c = d->channel;
+  struct iov_cursor cur = { iov, 0 };
+  size_t left = iov_sectors (iov, iov_cnt);
+  size_t i;
+
+  while (left > 0)
+    {
+      size_t cnt = left < MAX_TRANSFER ? left : MAX_TRANSFER;
+      size_t done = 0;
+
+      select_sector (d, sec_no, cnt);
+      issue_pio_command (c, (d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                             : CMD_WRITE_SECTOR_RETRY));
+      while (done < cnt)
+        {
+          size_t block = drq_block_size (d, cnt, done);
+
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + done);
+          for (i = 0; i < block; i++)
+            output_sector (c, iov_next (&cur));
+          sema_down (&c->completion_wait);
+          done += block;
+        }
+      sec_no += cnt;
+      left -= cnt;
+    }
+}
+
+/* Returns true if the IOV_CNT buffers in IOV can be the target of
+   a DMA transfer on disk D.  The bus master only sees physical
+   memory, so every buffer must be in the kernel's mapping of it,
+   and it moves 16-bit words, so every buffer must be aligned on
+   a word. */
+static bool
+can_dma (const struct ata_disk *d,
+         const struct block_iovec *iov, size_t iov_cnt)
+{
+  size_t i;
+
+  if (!d->dma)
+    return false;
+  for (i = 0; i < iov_cnt; i++)
+    if (!is_kernel_vaddr (iov[i].buffer) || (uintptr_t) iov[i].buffer % 2)
+      return false;
+  return true;
+}
+
+/* Returns the number of bytes described by PRD. */
+static size_t
+prd_size (const struct prd *prd)
+{
+  return prd->size != 0 ? prd->size : PRD_BOUNDARY;
+}
+
+/* Fills channel C's PRD table with the buffers for up to CNT
+   sectors starting at cursor CUR, advancing CUR past them.
+   Merges physically contiguous buffers into a single descriptor
+   and splits buffers that cross a 64 kB boundary.  Returns the
+   number of sectors described, which is less than CNT only if
+   the table fills up. */
+static size_t
+fill_prdt (struct channel *c, struct iov_cursor *cur, size_t cnt)
+{
+  struct prd *prd = NULL;
+  size_t prd_cnt = 0;
+  size_t done;
+
+  for (done = 0; done < cnt && prd_cnt + 2 <= PRD_CNT; done++)
+    {
+      uintptr_t addr = vtop (iov_next (cur));
+      size_t left = BLOCK_SECTOR_SIZE;
+
+      while (left > 0)
+        {
+          size_t ofs = addr % PRD_BOUNDARY;
+          size_t size = left < PRD_BOUNDARY - ofs ? left : PRD_BOUNDARY - ofs;
+
+          if (prd != NULL && ofs != 0 && prd->addr + prd_size (prd) == addr)
+            prd->size += size;
+          else
+            {
+              prd = &c->prdt[prd_cnt++];
+              prd->addr = addr;
+              prd->size = size;
+              prd->flags = 0;
+            }
+          addr += size;
+          left -= size;
+        }
+    }
+  prd->flags = PRD_EOT;
+  return done;
+}
+
+/* Moves consecutive sectors of disk D, starting at SEC_NO, from
+   the IOV_CNT buffers in IOV to the disk if WRITE is true, or in
+   the other direction if it is false, by bus-master DMA.  The
+   CPU only sets up each command and then sleeps until the disk
+   interrupts to say the whole command is done.
+   D's channel must be locked, and can_dma() must have approved
+   IOV. */
+static void
+dma_transfer (struct ata_disk *d, block_sector_t sec_no,
+              const struct block_iovec *iov, size_t iov_cnt, bool write)
+{
+  struct channel *c = d->channel;
+  struct iov_cursor cur = { iov, 0 };
+  size_t left = iov_sectors (iov, iov_cnt);
+
+  while (left > 0)
+    {
+      size_t cnt = fill_prdt (c, &cur,
+                              left < MAX_TRANSFER ? left : MAX_TRANSFER);
+      uint8_t bm_status;
+
+      /* Point the bus master at the PRD table, clear its status,
+         and set the direction of transfer. */
+      outb (reg_bm_command (c), 0);
+      outl (reg_bm_prdt (c), vtop (c->prdt));
+      outb (reg_bm_status (c), inb (reg_bm_status (c)) | BMS_ERR | BMS_INTR);
+      outb (reg_bm_command (c), write ? 0 : BMC_READ);
+
+      /* Issue the command, start the bus master, and wait for
+         the completion interrupt. */
+      select_sector (d, sec_no, cnt);
+      issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+      outb (reg_bm_command (c), inb (reg_bm_command (c)) | BMC_START);
+      sema_down (&c->completion_wait);
+      outb (reg_bm_command (c), inb (reg_bm_command (c)) & ~BMC_START);
+
+      bm_status = inb (reg_bm_status (c));
+      if ((bm_status & BMS_ERR) || (inb (reg_alt_status (c)) & STA_ERR))
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+               d->name, write ? "write" : "read", sec_no);
+      sec_no += cnt;
+      left -= cnt;
+    }
+}
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
+   writes SEC_NO and CNT, which must be between 1 and
+   MAX_TRANSFER, to the disk's sector selection registers.  (We
    use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_TRANSFER);
 
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_TRANSFER ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
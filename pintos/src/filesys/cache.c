@@ -0,0 +1,444 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Buffer cache.
+
+   Every sector of the file system device that is read or
+   written goes through a fixed set of CACHE_SIZE entries.
+   Writes only modify the cached copy; a dirty entry reaches the
+   disk when it is evicted or when cache_flush() is called, which
+   a background "flusher" thread does every FLUSH_INTERVAL ticks,
+   or sooner once DIRTY_HIGH entries are dirty.
+   Entries are replaced with the second-chance "clock"
+   algorithm.
+
+   CACHE_LOCK protects the mapping from sectors to entries and
+   the clock hand.  Each entry's own lock protects its data and
+   is held across disk I/O, so that a miss does not hold up hits
+   on other entries.  An entry's sector only changes while both
+   locks are held, and only once the entry is clean, so a sector
+   is never read from disk while a newer copy is in the cache.
+
+   Sectors passed to cache_prefetch() are read into the cache by
+   a background "read-ahead" thread, so that a sequential reader
+   finds the next sectors already cached. */
+
+/* Number of cached sectors. */
+#define CACHE_SIZE 64
+
+/* The flusher writes back dirty entries every FLUSH_INTERVAL
+   ticks, checking every FLUSH_POLL ticks whether more than
+   DIRTY_HIGH entries are dirty and it should flush early. */
+#define FLUSH_INTERVAL (5 * TIMER_FREQ)
+#define FLUSH_POLL (TIMER_FREQ / 10)
+#define DIRTY_HIGH (CACHE_SIZE * 3 / 4)
+
+/* A cached sector. */
+struct cache_entry
+  {
+    struct lock lock;           /* Protects the members below. */
+    block_sector_t sector;      /* Sector held, if VALID. */
+    bool valid;                 /* Holds a sector? */
+    bool dirty;                 /* Modified since read or written? */
+    bool accessed;              /* Used since the clock hand passed? */
+    uint8_t *data;              /* BLOCK_SECTOR_SIZE bytes. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static size_t hand;
+static size_t dirty_cnt;        /* Number of dirty entries. */
+static struct lock flush_lock;  /* Serializes cache_flush(). */
+
+/* Sectors waiting to be read ahead, as a circular queue of
+   RA_QUEUE_SIZE elements.  When the queue is full, further
+   requests are dropped. */
+#define RA_QUEUE_SIZE 64
+static block_sector_t ra_queue[RA_QUEUE_SIZE];
+static size_t ra_head;
+static size_t ra_cnt;
+static struct lock ra_lock;
+static struct condition ra_nonempty;
+
+static struct cache_entry *cache_get (block_sector_t, bool load, bool *hit);
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_select (void);
+static void cache_write_back (struct cache_entry *);
+static void write_run (struct cache_entry **, size_t cnt);
+static void read_ahead (void *aux);
+static void flusher (void *aux);
+static void mark_dirty (struct cache_entry *);
+static int compare_sectors (const void *, const void *);
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  uint8_t *data;
+  size_t i;
+
+  data = palloc_get_multiple (PAL_ASSERT,
+                              CACHE_SIZE * BLOCK_SECTOR_SIZE / PGSIZE);
+  lock_init (&cache_lock);
+  lock_init (&flush_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      lock_init (&e->lock);
+      e->valid = false;
+      e->dirty = false;
+      e->accessed = false;
+      e->data = data + i * BLOCK_SECTOR_SIZE;
+    }
+  hand = 0;
+  dirty_cnt = 0;
+
+  lock_init (&ra_lock);
+  cond_init (&ra_nonempty);
+  ra_head = ra_cnt = 0;
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead, NULL);
+  thread_create ("flusher", PRI_DEFAULT, flusher, NULL);
+}
+
+/* Reads SECTOR of the file system device into BUFFER, which
+   must have room for BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to SECTOR of the
+   file system device. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte offset OFS within SECTOR
+   into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+  bool hit;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true, &hit);
+  memcpy (buffer, e->data + ofs, size);
+  lock_release (&e->lock);
+  block_count_cache (fs_device, hit);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at byte
+   offset OFS.  A write of the whole sector does not need to read
+   it first. */
+void
+cache_write_at (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+  bool hit;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE, &hit);
+  memcpy (e->data + ofs, buffer, size);
+  mark_dirty (e);
+  lock_release (&e->lock);
+  block_count_cache (fs_device, hit);
+}
+
+/* Asks for SECTOR to be read into the cache in the background,
+   in anticipation of a read.  May drop the request if too many
+   are already pending. */
+void
+cache_prefetch (block_sector_t sector)
+{
+  lock_acquire (&ra_lock);
+  if (ra_cnt < RA_QUEUE_SIZE)
+    {
+      ra_queue[(ra_head + ra_cnt) % RA_QUEUE_SIZE] = sector;
+      ra_cnt++;
+      cond_signal (&ra_nonempty, &ra_lock);
+    }
+  lock_release (&ra_lock);
+}
+
+/* Read-ahead thread.  Brings each sector in the read-ahead
+   queue into the cache. */
+static void
+read_ahead (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct cache_entry *e;
+      block_sector_t sector;
+      bool hit;
+
+      lock_acquire (&ra_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_nonempty, &ra_lock);
+      sector = ra_queue[ra_head];
+      ra_head = (ra_head + 1) % RA_QUEUE_SIZE;
+      ra_cnt--;
+      lock_release (&ra_lock);
+
+      e = cache_get (sector, true, &hit);
+      lock_release (&e->lock);
+    }
+}
+
+/* Flusher thread.  Syncs the file system periodically, and
+   sooner when many entries are dirty, so that the free map's
+   changes reach the cache and dirty entries reach the disk. */
+static void
+flusher (void *aux UNUSED)
+{
+  int64_t last_flush = timer_ticks ();
+
+  for (;;)
+    {
+      timer_sleep (FLUSH_POLL);
+      if (dirty_cnt > DIRTY_HIGH
+          || timer_elapsed (last_flush) >= FLUSH_INTERVAL)
+        {
+          filesys_sync ();
+          last_flush = timer_ticks ();
+        }
+    }
+}
+
+/* Writes every dirty entry to disk, in ascending sector order.
+   Each run of dirty entries that hold consecutive sectors is
+   written with a single multi-sector request. */
+void
+cache_flush (void)
+{
+  /* Too big for a kernel stack, which may already hold a system
+     call and file system frames.  Protected by FLUSH_LOCK. */
+  static struct cache_entry *dirty[CACHE_SIZE];
+  static struct cache_entry *run[CACHE_SIZE];
+  size_t cnt = 0;
+  size_t run_cnt = 0;
+  size_t i;
+
+  lock_acquire (&flush_lock);
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].dirty)
+      dirty[cnt++] = &cache[i];
+  lock_release (&cache_lock);
+
+  /* Entries may change while we sort them, which is harmless: each
+     is checked again once it is locked.  Only this thread ever
+     holds more than one entry lock at a time, so holding a whole
+     run's locks cannot deadlock. */
+  qsort (dirty, cnt, sizeof *dirty, compare_sectors);
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_entry *e = dirty[i];
+
+      lock_acquire (&e->lock);
+      if (!e->valid || !e->dirty)
+        {
+          lock_release (&e->lock);
+          continue;
+        }
+      if (run_cnt > 0 && e->sector != run[run_cnt - 1]->sector + 1)
+        {
+          write_run (run, run_cnt);
+          run_cnt = 0;
+        }
+      run[run_cnt++] = e;
+    }
+  write_run (run, run_cnt);
+  lock_release (&flush_lock);
+}
+
+/* Writes the CNT dirty entries in RUN, which hold consecutive
+   sectors and are locked by the caller, to disk in one request,
+   marks them clean, and releases their locks.  The caller must
+   hold FLUSH_LOCK, which protects IOV. */
+static void
+write_run (struct cache_entry **run, size_t cnt)
+{
+  static struct block_iovec iov[CACHE_SIZE];
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&flush_lock));
+
+  if (cnt == 0)
+    return;
+
+  for (i = 0; i < cnt; i++)
+    {
+      iov[i].buffer = run[i]->data;
+      iov[i].sector_cnt = 1;
+    }
+  block_write_multi (fs_device, run[0]->sector, iov, cnt);
+
+  lock_acquire (&cache_lock);
+  dirty_cnt -= cnt;
+  lock_release (&cache_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      run[i]->dirty = false;
+      lock_release (&run[i]->lock);
+    }
+}
+
+/* Compares the sectors held by the cache entries that A and B
+   point to, for qsort(). */
+static int
+compare_sectors (const void *a_, const void *b_)
+{
+  const struct cache_entry *a = *(struct cache_entry *const *) a_;
+  const struct cache_entry *b = *(struct cache_entry *const *) b_;
+
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Returns the entry for SECTOR with its lock held, bringing
+   SECTOR into the cache if necessary.  The entry's data is read
+   from disk only if LOAD is true; otherwise the caller must
+   overwrite all of it.  Sets *HIT to true if SECTOR was already
+   cached, false otherwise. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool load, bool *hit)
+{
+  for (;;)
+    {
+      struct cache_entry *e;
+
+      lock_acquire (&cache_lock);
+      e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          /* Hit.  The entry may be replaced while we wait for its
+             lock, so check again once we have it. */
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          if (e->valid && e->sector == sector)
+            {
+              e->accessed = true;
+              *hit = true;
+              return e;
+            }
+          lock_release (&e->lock);
+          continue;
+        }
+
+      e = cache_select ();
+      if (e == NULL)
+        {
+          /* Every entry is busy. */
+          lock_release (&cache_lock);
+          thread_yield ();
+          continue;
+        }
+      if (e->valid && e->dirty)
+        {
+          /* Write back the victim, keeping it findable under its
+             old sector meanwhile, then start over. */
+          lock_release (&cache_lock);
+          cache_write_back (e);
+          lock_release (&e->lock);
+          continue;
+        }
+
+      /* Miss with a clean victim. */
+      e->sector = sector;
+      e->valid = true;
+      e->accessed = true;
+      lock_release (&cache_lock);
+      if (load)
+        block_read (fs_device, sector, e->data);
+      *hit = false;
+      return e;
+    }
+}
+
+/* Returns the entry that holds SECTOR, or a null pointer if
+   there is none.  Must be called with CACHE_LOCK held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Advances the clock hand to an entry that is unused or has not
+   been accessed since the hand last passed it, clearing accessed
+   bits along the way.  Returns the entry with its lock held, or a
+   null pointer if every entry is busy.
+   Must be called with CACHE_LOCK held. */
+static struct cache_entry *
+cache_select (void)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[hand];
+
+      hand = (hand + 1) % CACHE_SIZE;
+      if (!lock_try_acquire (&e->lock))
+        continue;
+      if (!e->valid || !e->accessed)
+        return e;
+      e->accessed = false;
+      lock_release (&e->lock);
+    }
+  return NULL;
+}
+
+/* Marks entry E, which must be locked, as dirty. */
+static void
+mark_dirty (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&e->lock));
+
+  if (!e->dirty)
+    {
+      e->dirty = true;
+      lock_acquire (&cache_lock);
+      dirty_cnt++;
+      lock_release (&cache_lock);
+    }
+}
+
+/* Writes entry E to disk if it is dirty.  E's lock must be
+   held. */
+static void
+cache_write_back (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&e->lock));
+
+  if (e->valid && e->dirty)
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+      lock_acquire (&cache_lock);
+      dirty_cnt--;
+      lock_release (&cache_lock);
+    }
+}
@@ -0,0 +1,180 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Remembers the results of recent directory lookups, keyed by
+   the directory's inode sector and the name looked up, so that
+   opening the same names again does not need to search the
+   directory.  A negative entry, with sector 0, records that the
+   name does not exist; sector 0 holds the free map's inode, so it
+   is never the inode of a file.
+
+   The directory code keeps the cache consistent by inserting
+   entries when it adds names and invalidating them when it
+   removes names.  At most DCACHE_SIZE entries are kept; the least
+   recently used one is discarded to make room. */
+
+#define DCACHE_SIZE 128
+
+/* A cached lookup result. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in DENTRIES. */
+    struct list_elem lru_elem;          /* Element in LRU. */
+    block_sector_t dir;                 /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name looked up. */
+    block_sector_t sector;              /* NAME's inode, or 0. */
+  };
+
+static struct hash dentries;
+static struct list lru;                 /* Most recently used first. */
+static size_t dentry_cnt;
+static struct lock dcache_lock;         /* Protects all of the above. */
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+static struct dentry *find (block_sector_t dir, const char *name);
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  if (!hash_init (&dentries, dentry_hash, dentry_less, NULL))
+    PANIC ("directory entry cache initialization failed");
+  list_init (&lru);
+  dentry_cnt = 0;
+  lock_init (&dcache_lock);
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+   Returns true if the cache knows the answer, in which case
+   *SECTOR is set to NAME's inode sector, or to 0 if DIR has no
+   entry for NAME.  Returns false if the cache does not know. */
+bool
+dcache_lookup (block_sector_t dir, const char *name, block_sector_t *sector)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&lru, &d->lru_elem);
+      *sector = d->sector;
+    }
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in sector
+   DIR refers to the inode in SECTOR, or, if SECTOR is 0, that DIR
+   has no entry for NAME. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      d->sector = sector;
+      list_push_front (&lru, &d->lru_elem);
+      lock_release (&dcache_lock);
+      return;
+    }
+
+  if (dentry_cnt >= DCACHE_SIZE)
+    {
+      /* Reuse the least recently used entry. */
+      d = list_entry (list_pop_back (&lru), struct dentry, lru_elem);
+      hash_delete (&dentries, &d->hash_elem);
+    }
+  else
+    {
+      d = malloc (sizeof *d);
+      if (d == NULL)
+        {
+          lock_release (&dcache_lock);
+          return;
+        }
+      dentry_cnt++;
+    }
+
+  d->dir = dir;
+  strlcpy (d->name, name, sizeof d->name);
+  d->sector = sector;
+  hash_insert (&dentries, &d->hash_elem);
+  list_push_front (&lru, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets anything cached about NAME in the directory whose inode
+   is in sector DIR. */
+void
+dcache_invalidate (block_sector_t dir, const char *name)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      hash_delete (&dentries, &d->hash_elem);
+      list_remove (&d->lru_elem);
+      dentry_cnt--;
+      free (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer if there
+   is none.  Must be called with DCACHE_LOCK held. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&dcache_lock));
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Returns a hash value for dentry E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
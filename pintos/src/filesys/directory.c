@@ -1,16 +1,37 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
-/* A directory. */
+/* A directory.
+
+   A directory file is an array of sector-sized blocks.  Block 0
+   holds a struct dir_header.  Blocks 1 through BUCKET_CNT are hash
+   buckets: an entry for a name is kept in the bucket selected by
+   hashing the name, or, once that bucket fills up, in one of the
+   overflow blocks chained from it.  Overflow blocks are added at
+   the end of the file.  Every block but the header starts with
+   the number of the next block in its chain, or 0, followed by
+   ENTRIES_PER_BLOCK entries.
+
+   A new directory holds only its header.  Bucket blocks that
+   have never had an entry are holes, or lie past the end of the
+   file, and read as empty, so a directory uses disk space only
+   for the buckets it has used.
+
+   Looking up a name thus reads only the bucket's chain, usually
+   a single sector, however large the directory grows. */
 struct dir
   {
     struct inode *inode;                /* Backing store. */
-    off_t pos;                          /* Current position. */
+    off_t pos;                          /* Current slot, for readdir. */
+    uint32_t bucket_cnt;                /* Number of hash buckets. */
   };
 
 /* A single directory entry. */
@@ -21,12 +42,67 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* Block 0 of a directory file. */
+struct dir_header
+  {
+    unsigned magic;                     /* DIR_MAGIC. */
+    uint32_t bucket_cnt;                /* Number of hash buckets. */
+  };
+
+/* Identifies a directory. */
+#define DIR_MAGIC 0x44495248
+
+/* Entries per block, after the link to the next block. */
+#define ENTRIES_PER_BLOCK ((BLOCK_SECTOR_SIZE - sizeof (uint32_t)) \
+                           / sizeof (struct dir_entry))
+
+/* Fewest hash buckets a directory is created with. */
+#define MIN_BUCKETS 16
+
+/* Returns the byte offset of entry IDX in block BLOCK. */
+static off_t
+entry_ofs (uint32_t block, size_t idx)
+{
+  return (block * BLOCK_SECTOR_SIZE + sizeof (uint32_t)
+          + idx * sizeof (struct dir_entry));
+}
+
+/* Returns the block that follows BLOCK in its chain in DIR, or 0
+   if BLOCK is the last. */
+static uint32_t
+next_block (const struct dir *dir, uint32_t block)
+{
+  uint32_t next;
+
+  if (inode_read_at (dir->inode, &next, sizeof next,
+                     block * BLOCK_SECTOR_SIZE) != sizeof next)
+    return 0;
+  return next;
+}
+
+/* Creates a directory in the given SECTOR with enough hash
+   buckets for ENTRY_CNT entries without overflow.  Returns true
+   if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir_header h;
+  struct inode *inode;
+  bool success;
+
+  h.magic = DIR_MAGIC;
+  h.bucket_cnt = DIV_ROUND_UP (entry_cnt, ENTRIES_PER_BLOCK);
+  if (h.bucket_cnt < MIN_BUCKETS)
+    h.bucket_cnt = MIN_BUCKETS;
+
+  if (!inode_create (sector, 0))
+    return false;
+  inode = inode_open (sector);
+  if (inode == NULL)
+    return false;
+  success = inode_write_at (inode, &h, sizeof h, 0) == sizeof h;
+  inode_close (inode);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -35,10 +111,15 @@ struct dir *
 dir_open (struct inode *inode)
 {
   struct dir *dir = calloc (1, sizeof *dir);
-  if (inode != NULL && dir != NULL)
+  struct dir_header h;
+
+  if (inode != NULL && dir != NULL
+      && inode_read_at (inode, &h, sizeof h, 0) == sizeof h
+      && h.magic == DIR_MAGIC && h.bucket_cnt > 0)
     {
       dir->inode = inode;
       dir->pos = 0;
+      dir->bucket_cnt = h.bucket_cnt;
       return dir;
     }
   else
@@ -83,51 +164,87 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
+/* Searches DIR for a file with the given NAME, reading only the
+   chain of blocks for NAME's hash bucket.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   Otherwise, returns false and ignores EP and OFSP.
+   Either way, if FREEP is non-null, sets *FREEP to the byte
+   offset of the first free entry in the chain, or to -1 if it
+   has none, and sets *LASTP to the last block in the chain. */
 static bool
 lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp)
+        struct dir_entry *ep, off_t *ofsp, off_t *freep, uint32_t *lastp)
 {
   struct dir_entry e;
-  size_t ofs;
+  uint32_t block;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (e.in_use && !strcmp (name, e.name))
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  if (freep != NULL)
+    *freep = -1;
+  block = 1 + hash_string (name) % dir->bucket_cnt;
+  for (;;)
+    {
+      size_t i;
+
+      for (i = 0; i < ENTRIES_PER_BLOCK; i++)
+        {
+          off_t ofs = entry_ofs (block, i);
+
+          /* Slots past the end of the file are empty. */
+          if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+            e.in_use = false;
+          if (e.in_use && !strcmp (name, e.name))
+            {
+              if (ep != NULL)
+                *ep = e;
+              if (ofsp != NULL)
+                *ofsp = ofs;
+              return true;
+            }
+          if (!e.in_use && freep != NULL && *freep == -1)
+            *freep = ofs;
+        }
+
+      if (lastp != NULL)
+        *lastp = block;
+      block = next_block (dir, block);
+      if (block == 0)
+        return false;
+    }
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Consults the directory entry cache first, and records the
+   result there.  DIR is locked throughout, so that a concurrent
+   dir_add() or dir_remove() cannot change the entry between the
+   search and the cache insertion. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode)
 {
+  block_sector_t dir_sector;
+  block_sector_t sector;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  dir_sector = inode_get_inumber (dir->inode);
+  inode_lock (dir->inode);
+  if (!dcache_lookup (dir_sector, name, &sector))
+    {
+      sector = lookup (dir, name, &e, NULL, NULL, NULL) ? e.inode_sector : 0;
+      dcache_insert (dir_sector, name, sector);
+    }
+  *inode = sector != 0 ? inode_open (sector) : NULL;
+  inode_unlock (dir->inode);
 
   return *inode != NULL;
 }
@@ -143,6 +260,7 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
   struct dir_entry e;
   off_t ofs;
+  uint32_t last;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -152,29 +270,46 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
-    goto done;
+  inode_lock (dir->inode);
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
+  /* Check that NAME is not in use, finding a free slot in its
+     bucket's chain in the same pass. */
+  if (lookup (dir, name, NULL, NULL, &ofs, &last))
+    goto done;
 
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (!e.in_use)
-      break;
+  /* If the chain is full, chain a new, zeroed block onto it from
+     the end of the file. */
+  if (ofs == -1)
+    {
+      uint32_t block = DIV_ROUND_UP (inode_length (dir->inode),
+                                     BLOCK_SECTOR_SIZE);
+      uint32_t zero = 0;
+
+      /* Bucket blocks not yet written may lie past the end. */
+      if (block < 1 + dir->bucket_cnt)
+        block = 1 + dir->bucket_cnt;
+
+      if (inode_write_at (dir->inode, &zero, sizeof zero,
+                          (block + 1) * BLOCK_SECTOR_SIZE - sizeof zero)
+          != sizeof zero
+          || inode_write_at (dir->inode, &block, sizeof block,
+                             last * BLOCK_SECTOR_SIZE) != sizeof block)
+        goto done;
+      ofs = entry_ofs (block, 0);
+    }
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
+  else
+    dcache_invalidate (inode_get_inumber (dir->inode), name);
 
  done:
+  inode_unlock (dir->inode);
   return success;
 }
 
@@ -192,8 +327,10 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  inode_lock (dir->inode);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  if (!lookup (dir, name, &e, &ofs, NULL, NULL))
     goto done;
 
   /* Open inode. */
@@ -205,12 +342,14 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
     goto done;
+  dcache_insert (inode_get_inumber (dir->inode), name, 0);
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  inode_unlock (dir->inode);
   inode_close (inode);
   return success;
 }
@@ -223,14 +362,19 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
+  /* DIR->POS counts entry slots, starting from block 1. */
+  for (;;)
     {
-      dir->pos += sizeof e;
+      off_t ofs = entry_ofs (1 + dir->pos / ENTRIES_PER_BLOCK,
+                             dir->pos % ENTRIES_PER_BLOCK);
+
+      if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+        return false;
+      dir->pos++;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
           return true;
         }
     }
-  return false;
 }
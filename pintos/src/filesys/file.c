@@ -1,5 +1,6 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/block.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
@@ -9,8 +10,22 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+
+    /* Read-ahead. */
+    off_t ra_next;              /* Offset where a sequential read resumes. */
+    off_t ra_end;               /* End of data already read ahead. */
+    int ra_window;              /* Sectors to read ahead, 0 if random. */
   };
 
+/* Read-ahead window bounds, in sectors.  The window opens at
+   RA_MIN on the first sequential read, one that resumes where
+   the last read ended (or starts a new file at offset 0), and
+   doubles with each further one, up to RA_MAX. */
+#define RA_MIN 2
+#define RA_MAX 32
+
+static void read_ahead (struct file *, off_t ofs, off_t bytes_read);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -69,6 +84,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size)
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  read_ahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,15 +97,49 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  read_ahead (file, file_ofs, bytes_read);
+  return bytes_read;
+}
+
+/* Notes that BYTES_READ bytes were just read from FILE at OFS.
+   If the read continued where the previous one left off, widens
+   the read-ahead window and starts reading the window past the
+   end of this read into the buffer cache.  Any other read shuts
+   read-ahead off. */
+static void
+read_ahead (struct file *file, off_t ofs, off_t bytes_read)
+{
+  off_t end = ofs + bytes_read;
+  off_t ra_start, ra_limit;
+
+  if (bytes_read == 0 || ofs != file->ra_next)
+    {
+      file->ra_window = 0;
+      file->ra_end = end;
+      file->ra_next = end;
+      return;
+    }
+  file->ra_next = end;
+  if (file->ra_window == 0)
+    file->ra_window = RA_MIN;
+  else if (file->ra_window < RA_MAX)
+    file->ra_window *= 2;
+
+  ra_start = file->ra_end > end ? file->ra_end : end;
+  ra_limit = end + file->ra_window * BLOCK_SECTOR_SIZE;
+  if (ra_limit > ra_start)
+    {
+      inode_read_ahead (file->inode, ra_limit - ra_start, ra_start);
+      file->ra_end = ra_limit;
+    }
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file extends the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size)
@@ -102,9 +152,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file extends the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -2,6 +2,8 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
@@ -21,8 +23,10 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
-  inode_init ();
   free_map_init ();
+  cache_init ();
+  dcache_init ();
+  inode_init ();
 
   if (format)
     do_format ();
@@ -36,8 +40,17 @@ void
 filesys_done (void)
 {
   free_map_close ();
+  cache_flush ();
 }
 
+/* Writes all modified file system data to disk. */
+void
+filesys_sync (void)
+{
+  free_map_flush ();
+  cache_flush ();
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -47,8 +60,12 @@ filesys_create (const char *name, off_t initial_size)
 {
   block_sector_t inode_sector = 0;
   struct dir *dir = dir_open_root ();
+
+  /* Place the new inode near its directory's. */
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate_near (inode_get_inumber
+                                             (dir_get_inode (dir)),
+                                             1, &inode_sector)
                   && inode_create (inode_sector, initial_size)
                   && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0)
@@ -1,12 +1,36 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
+
+/* The free map is kept in memory.  Allocating and releasing
+   sectors only marks the sectors of the free map file that hold
+   the changed bits as dirty; free_map_flush() writes just those
+   sectors back, when the file system is synced or shut down.
+
+   Allocations without a goal are next-fit: they search from a
+   cursor that rotates through the disk, just past the previous
+   such allocation, so that they do not rescan the full start of
+   the disk each time.  Allocations with a goal look for a run
+   within NEAR_WINDOW sectors after the goal, then within
+   NEAR_WINDOW sectors before it, and only then fall back to the
+   cursor. */
+#define NEAR_WINDOW 1024
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *dirty_map;     /* Free map file sectors to write. */
+static block_sector_t cursor;        /* Where next-fit search starts. */
+static struct lock free_map_lock;    /* Protects the members above. */
+
+static void mark_dirty (block_sector_t, size_t cnt);
+static block_sector_t scan (block_sector_t start, block_sector_t end,
+                            size_t cnt);
+static block_sector_t take (block_sector_t, size_t cnt);
 
 /* Initializes the free map. */
 void
@@ -17,36 +41,169 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                           BLOCK_SECTOR_SIZE));
+  if (dirty_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  cursor = 0;
+  lock_init (&free_map_lock);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
-    }
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = take (BITMAP_ERROR, cnt);
+  lock_release (&free_map_lock);
+
+  if (sector != BITMAP_ERROR)
+    *sectorp = sector;
+  return sector != BITMAP_ERROR;
+}
+
+/* Like free_map_allocate(), but takes a run of CNT free sectors
+   as close to GOAL as it can find nearby, so that related data,
+   such as a file's inode and its blocks, can be kept close
+   together. */
+bool
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = take (goal, cnt);
+  lock_release (&free_map_lock);
+
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Finds and allocates a run of CNT free sectors near GOAL, or
+   next-fit if GOAL is BITMAP_ERROR or nothing near it is free.
+   Returns the first sector of the run, or BITMAP_ERROR if there
+   is no such run.  Must be called with FREE_MAP_LOCK held. */
+static block_sector_t
+take (block_sector_t goal, size_t cnt)
+{
+  size_t size = bitmap_size (free_map);
+  block_sector_t sector = BITMAP_ERROR;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+
+  if (cnt == 0 || cnt > size)
+    return BITMAP_ERROR;
+
+  if (goal < size)
+    {
+      sector = scan (goal, goal + NEAR_WINDOW, cnt);
+      if (sector == BITMAP_ERROR)
+        sector = scan (goal > NEAR_WINDOW ? goal - NEAR_WINDOW : 0, goal, cnt);
+    }
+  if (sector == BITMAP_ERROR)
+    {
+      sector = scan (cursor, size, cnt);
+      if (sector == BITMAP_ERROR)
+        sector = scan (0, cursor, cnt);
+      if (sector != BITMAP_ERROR)
+        cursor = (sector + cnt) % size;
+    }
+
+  if (sector != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      mark_dirty (sector, cnt);
+    }
+  return sector;
+}
+
+/* Returns the first sector in [START, END) that begins a run of
+   CNT free sectors, or BITMAP_ERROR if there is none.  The run
+   may extend past END.  Must be called with FREE_MAP_LOCK held.
+
+   Each candidate run is checked from its end backward, so that
+   finding a used sector skips every candidate that would
+   contain it. */
+static block_sector_t
+scan (block_sector_t start, block_sector_t end, size_t cnt)
+{
+  size_t size = bitmap_size (free_map);
+  size_t i = start;
+
+  ASSERT (cnt > 0 && cnt <= size);
+
+  if (end > size - cnt + 1)
+    end = size - cnt + 1;
+  while (i < end)
+    {
+      size_t j = cnt;
+
+      while (j > 0 && !bitmap_test (free_map, i + j - 1))
+        j--;
+      if (j == 0)
+        return i;
+      i += j;
+    }
+  return BITMAP_ERROR;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Marks the sectors of the free map file that hold the bits for
+   the CNT sectors starting at SECTOR as needing to be written.
+   Must be called with FREE_MAP_LOCK held. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / 8 / BLOCK_SECTOR_SIZE;
+  size_t last = (sector + cnt - 1) / 8 / BLOCK_SECTOR_SIZE;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  ASSERT (cnt > 0);
+
+  bitmap_set_multiple (dirty_map, first, last - first + 1, true);
+}
+
+/* Writes the changed sectors of the free map to the free map
+   file. */
+void
+free_map_flush (void)
+{
+  size_t file_size = bitmap_file_size (free_map);
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    for (i = 0; i < bitmap_size (dirty_map); i++)
+      if (bitmap_test (dirty_map, i))
+        {
+          size_t ofs = i * BLOCK_SECTOR_SIZE;
+          size_t size = file_size - ofs;
+
+          if (size > BLOCK_SECTOR_SIZE)
+            size = BLOCK_SECTOR_SIZE;
+          if (!bitmap_write_part (free_map, free_map_file, ofs, size))
+            PANIC ("can't write free map");
+          bitmap_reset (dirty_map, i);
+        }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,13 +215,18 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (dirty_map, false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void)
 {
+  free_map_flush ();
+  lock_acquire (&free_map_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -82,4 +244,5 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_map, false);
 }
@@ -1,9 +1,12 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <inttypes.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
+#include "devices/timer.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
@@ -67,8 +70,13 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/* Pages of file data that fsutil_extract() reads from the
+   scratch device with each request. */
+#define EXTRACT_PAGES 16
+
 /* Extracts a ustar-format tar archive from the scratch block
-   device into the Pintos file system. */
+   device into the Pintos file system, reporting how fast it
+   went. */
 void
 fsutil_extract (char **argv UNUSED)
 {
@@ -76,10 +84,14 @@ fsutil_extract (char **argv UNUSED)
 
   struct block *src;
   void *header, *data;
+  int64_t start = timer_ticks ();
+  int64_t elapsed;
+  unsigned long long bytes = 0;
+  int file_cnt = 0;
 
   /* Allocate buffers. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
+  data = palloc_get_multiple (0, EXTRACT_PAGES);
   if (header == NULL || data == NULL)
     PANIC ("couldn't allocate buffers");
 
@@ -117,20 +129,29 @@ fsutil_extract (char **argv UNUSED)
 
           printf ("Putting '%s' into the file system...\n", file_name);
 
-          /* Create destination file. */
+          /* Create destination file.  Creating it at full size
+             allocates all of its sectors at once, in as few runs
+             as the free map allows. */
           if (!filesys_create (file_name, size))
             PANIC ("%s: create failed", file_name);
           dst = filesys_open (file_name);
           if (dst == NULL)
             PANIC ("%s: open failed", file_name);
+          bytes += size;
+          file_cnt++;
 
-          /* Do copy. */
+          /* Do copy, up to EXTRACT_PAGES pages at a time. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
+              int chunk_size = (size > EXTRACT_PAGES * PGSIZE
+                                ? EXTRACT_PAGES * PGSIZE
                                 : size);
-              block_read (src, sector++, data);
+              struct block_iovec iov;
+
+              iov.buffer = data;
+              iov.sector_cnt = DIV_ROUND_UP (chunk_size, BLOCK_SECTOR_SIZE);
+              block_read_multi (src, sector, &iov, 1);
+              sector += iov.sector_cnt;
               if (file_write (dst, data, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
@@ -151,7 +172,14 @@ fsutil_extract (char **argv UNUSED)
   block_write (src, 0, header);
   block_write (src, 1, header);
 
-  free (data);
+  elapsed = timer_elapsed (start);
+  printf ("Extracted %d files, %llu bytes, in %"PRId64" ms",
+          file_cnt, bytes, elapsed * 1000 / TIMER_FREQ);
+  if (elapsed > 0)
+    printf (" (%llu kB/s)", bytes * TIMER_FREQ / 1024 / elapsed);
+  printf ("\n");
+
+  palloc_free_multiple (data, EXTRACT_PAGES);
   free (header);
 }
 
@@ -1,25 +1,74 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of data sectors indexed directly by an inode, and
+   number of sector numbers in an index block. */
+#define DIRECT_CNT 124
+#define PTRS_PER_SECTOR ((size_t) (BLOCK_SECTOR_SIZE \
+                                   / sizeof (block_sector_t)))
+
+/* Positions of the indirect and doubly indirect index blocks in
+   struct inode_disk's SECTORS. */
+#define INDIRECT_IDX DIRECT_CNT
+#define DBL_INDIRECT_IDX (DIRECT_CNT + 1)
+#define SECTOR_CNT (DIRECT_CNT + 2)
+
+/* Most data sectors one inode can index: a little over 8 MB,
+   which is as large as a Pintos file system device gets. */
+#define MAX_SECTORS (DIRECT_CNT + PTRS_PER_SECTOR \
+                     + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
+/* Largest file whose data is kept in the inode itself. */
+#define INLINE_MAX ((off_t) (SECTOR_CNT * sizeof (block_sector_t)))
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   Data sector I of the file is SECTORS[I] for I < DIRECT_CNT.
+   The next PTRS_PER_SECTOR are listed in the indirect block
+   SECTORS[INDIRECT_IDX], and the rest in the index blocks listed
+   in the doubly indirect block SECTORS[DBL_INDIRECT_IDX].  Sector
+   0 holds the free map's inode, so it never appears as a data or
+   index sector and a 0 entry means "not allocated".  A data
+   sector that is not allocated is a hole: it reads as zeros, and
+   a sector is allocated for it only when it is written.  Only
+   inode_create() allocates data sectors ahead of time.
+
+   A file of at most INLINE_MAX bytes has no data sectors.
+   Instead its data is stored in DATA, in place of SECTORS, at the
+   start of the inode's own sector, so that reading it takes no
+   disk access beyond the inode.  When such a file grows past
+   INLINE_MAX bytes, its data moves out to a data sector. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    union
+      {
+        block_sector_t sectors[SECTOR_CNT]; /* Data and index sectors. */
+        uint8_t data[INLINE_MAX];           /* Inline data. */
+      };
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
   };
 
+/* Returns true if DISK's data is stored inline. */
+static inline bool
+is_inline (const struct inode_disk *disk)
+{
+  return disk->length <= INLINE_MAX;
+}
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -28,19 +77,298 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.
+
+   DATA_LOCK is held for reading by inode_read_at() and for
+   writing by inode_write_at(), so any number of threads may read
+   a file at once while writes to it are atomic.  Only writers
+   change DATA, so DATA_LOCK alone makes it stable for readers.
+   META_LOCK also protects DATA, along with REMOVED and
+   DENY_WRITE_CNT, for the functions that inspect an inode
+   without holding DATA_LOCK.  It is held only briefly, never
+   across file data I/O.  OPEN_CNT is protected by
+   OPEN_INODES_LOCK, which is also never held across I/O. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct lock lock;                   /* Held by inode_lock(). */
+    struct rwlock data_lock;            /* Serializes writers with readers. */
+    struct lock meta_lock;              /* Protects members below. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Returns entry IDX of index block BLOCK. */
+static block_sector_t
+index_get (block_sector_t block, size_t idx)
+{
+  block_sector_t sector;
+
+  cache_read_at (block, &sector, idx * sizeof sector, sizeof sector);
+  return sector;
+}
+
+/* Sets entry IDX of index block BLOCK to SECTOR. */
+static void
+index_set (block_sector_t block, size_t idx, block_sector_t sector)
+{
+  cache_write_at (block, &sector, idx * sizeof sector, sizeof sector);
+}
+
+/* Allocates an index block with all entries 0, preferably at or
+   after GOAL, and stores it in *SECTORP.
+   Returns true if successful, false if the disk is full. */
+static bool
+alloc_index (block_sector_t goal, block_sector_t *sectorp)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  if (!free_map_allocate_near (goal, 1, sectorp))
+    return false;
+  cache_write (*sectorp, zeros);
+  return true;
+}
+
+/* Returns data sector IDX of DISK, or 0 if it is not
+   allocated. */
+static block_sector_t
+get_data_sector (const struct inode_disk *disk, size_t idx)
+{
+  block_sector_t block;
+
+  if (idx < DIRECT_CNT)
+    return disk->sectors[idx];
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR)
+    {
+      block = disk->sectors[INDIRECT_IDX];
+      return block != 0 ? index_get (block, idx) : 0;
+    }
+  idx -= PTRS_PER_SECTOR;
+
+  if (idx >= PTRS_PER_SECTOR * PTRS_PER_SECTOR
+      || disk->sectors[DBL_INDIRECT_IDX] == 0)
+    return 0;
+  block = index_get (disk->sectors[DBL_INDIRECT_IDX], idx / PTRS_PER_SECTOR);
+  return block != 0 ? index_get (block, idx % PTRS_PER_SECTOR) : 0;
+}
+
+/* Makes SECTOR data sector IDX of DISK, allocating index blocks
+   as needed.  Returns true if successful, false if IDX is beyond
+   the largest possible file or an index block could not be
+   allocated. */
+static bool
+set_data_sector (struct inode_disk *disk, size_t idx, block_sector_t sector)
+{
+  block_sector_t *dbl = &disk->sectors[DBL_INDIRECT_IDX];
+  block_sector_t block;
+
+  if (idx < DIRECT_CNT)
+    {
+      disk->sectors[idx] = sector;
+      return true;
+    }
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR)
+    {
+      if (disk->sectors[INDIRECT_IDX] == 0
+          && !alloc_index (sector, &disk->sectors[INDIRECT_IDX]))
+        return false;
+      index_set (disk->sectors[INDIRECT_IDX], idx, sector);
+      return true;
+    }
+  idx -= PTRS_PER_SECTOR;
+
+  if (idx >= PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    return false;
+  if (*dbl == 0 && !alloc_index (sector, dbl))
+    return false;
+  block = index_get (*dbl, idx / PTRS_PER_SECTOR);
+  if (block == 0)
+    {
+      if (!alloc_index (sector, &block))
+        return false;
+      index_set (*dbl, idx / PTRS_PER_SECTOR, block);
+    }
+  index_set (block, idx % PTRS_PER_SECTOR, sector);
+  return true;
+}
+
+/* Releases data sectors 0 through CNT - 1 of DISK and all of its
+   index blocks, and clears DISK's references to them. */
+static void
+release_sectors (struct inode_disk *disk, size_t cnt)
+{
+  block_sector_t run_start = 0;
+  size_t run_len = 0;
+  block_sector_t *dbl = &disk->sectors[DBL_INDIRECT_IDX];
+  size_t idx;
+
+  /* Release data sectors, a run of consecutive sectors at a
+     time. */
+  for (idx = 0; idx < cnt; idx++)
+    {
+      block_sector_t sector = get_data_sector (disk, idx);
+      if (sector == 0)
+        continue;
+      if (run_len > 0 && sector == run_start + run_len)
+        run_len++;
+      else
+        {
+          if (run_len > 0)
+            free_map_release (run_start, run_len);
+          run_start = sector;
+          run_len = 1;
+        }
+      if (idx < DIRECT_CNT)
+        disk->sectors[idx] = 0;
+    }
+  if (run_len > 0)
+    free_map_release (run_start, run_len);
+
+  /* Release index blocks. */
+  if (disk->sectors[INDIRECT_IDX] != 0)
+    {
+      free_map_release (disk->sectors[INDIRECT_IDX], 1);
+      disk->sectors[INDIRECT_IDX] = 0;
+    }
+  if (*dbl != 0)
+    {
+      size_t i;
+
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        {
+          block_sector_t block = index_get (*dbl, i);
+          if (block != 0)
+            free_map_release (block, 1);
+        }
+      free_map_release (*dbl, 1);
+      *dbl = 0;
+    }
+}
+
+/* Allocates zeroed data sectors for the first LENGTH bytes of
+   DISK, a new inode in sector INODE_SECTOR that has no data yet.
+   Sectors are allocated in runs that are as long as possible,
+   starting just after the inode when there is room, so that the
+   file is mostly contiguous on disk.  A file short enough to be
+   inline needs no sectors.  DISK's length is not changed.
+   Returns true if successful.  Returns false if LENGTH is too
+   large or the disk is full, in which case DISK is unchanged. */
+static bool
+preallocate (struct inode_disk *disk, block_sector_t inode_sector,
+             off_t length)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  size_t need = bytes_to_sectors (length);
+  size_t cnt = 0;
+  block_sector_t goal = inode_sector + 1;
+
+  ASSERT (disk->length == 0);
+
+  if (length <= INLINE_MAX)
+    return true;
+  if (need > MAX_SECTORS)
+    return false;
+
+  while (cnt < need)
+    {
+      size_t run = need - cnt;
+      block_sector_t start;
+      size_t i;
+
+      /* Settle for shorter runs if the disk is fragmented. */
+      while (!free_map_allocate_near (goal, run, &start))
+        {
+          if (run == 1)
+            goto fail;
+          run /= 2;
+        }
+
+      for (i = 0; i < run; i++)
+        {
+          cache_write (start + i, zeros);
+          if (!set_data_sector (disk, cnt, start + i))
+            {
+              free_map_release (start + i, run - i);
+              goto fail;
+            }
+          cnt++;
+        }
+      goal = start + run;
+    }
+  return true;
+
+ fail:
+  release_sectors (disk, cnt);
+  return false;
+}
+
+/* Allocates a sector to hold data sector IDX of DISK, the inode
+   in sector INODE_SECTOR, which must be a hole, next to the
+   preceding data sector if possible.  Zeros the new sector if
+   ZERO is true; otherwise the caller must overwrite all of it.
+   Returns the new sector, or 0 if the disk is full. */
+static block_sector_t
+alloc_data_sector (struct inode_disk *disk, block_sector_t inode_sector,
+                   size_t idx, bool zero)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  block_sector_t prev = idx > 0 ? get_data_sector (disk, idx - 1) : 0;
+  block_sector_t goal = prev != 0 ? prev + 1 : inode_sector + 1;
+  block_sector_t sector;
+
+  ASSERT (get_data_sector (disk, idx) == 0);
+
+  if (idx >= MAX_SECTORS || !free_map_allocate_near (goal, 1, &sector))
+    return 0;
+  if (!set_data_sector (disk, idx, sector))
+    {
+      free_map_release (sector, 1);
+      return 0;
+    }
+  if (zero)
+    cache_write (sector, zeros);
+  return sector;
+}
+
+/* Converts DISK, the inode in sector INODE_SECTOR, from storing
+   its data inline to indexing data sectors, in preparation for
+   growing it past INLINE_MAX bytes.  Moves the inline data, if
+   any, into a newly allocated first data sector.  Returns true if
+   successful, false if the disk is full, in which case DISK is
+   unchanged. */
+static bool
+move_inline_data (struct inode_disk *disk, block_sector_t inode_sector)
+{
+  uint8_t data[INLINE_MAX];
+  off_t length = disk->length;
+  block_sector_t sector;
+
+  ASSERT (is_inline (disk));
+
+  memcpy (data, disk->data, length);
+  memset (disk->sectors, 0, sizeof disk->sectors);
+  if (length == 0)
+    return true;
+
+  sector = alloc_data_sector (disk, inode_sector, 0, true);
+  if (sector == 0)
+    {
+      memcpy (disk->data, data, length);
+      return false;
+    }
+  cache_write_at (sector, data, 0, length);
+  return true;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within INODE, or 0 if POS is in a hole.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
@@ -48,20 +376,51 @@ byte_to_sector (const struct inode *inode, off_t pos)
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    return get_data_sector (&inode->data, pos / BLOCK_SECTOR_SIZE);
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  OPEN_INODES_LOCK
+   protects the table and every open inode's OPEN_CNT.  Like
+   META_LOCK, it is held only briefly and never across disk I/O,
+   so that opening one inode does not hold up opens and closes of
+   others. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+/* Number of times an inode has been removed from OPEN_INODES by
+   its last close.  Protected by OPEN_INODES_LOCK. */
+static unsigned close_gen;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("open inode table initialization failed");
+  lock_init (&open_inodes_lock);
+}
+
+/* Returns a hash value for the inode that E is in. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if the inode that A is in precedes the one that B
+   is in. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -84,20 +443,12 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
+      disk_inode->length = 0;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start))
+      if (preallocate (disk_inode, sector, length))
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0)
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-
-              for (i = 0; i < sectors; i++)
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          disk_inode->length = length;
+          cache_write (sector, disk_inode);
           success = true;
         }
       free (disk_inode);
@@ -107,37 +458,62 @@ inode_create (block_sector_t sector, off_t length)
 
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
+   Returns a null pointer if memory allocation fails.
+
+   The disk inode is read without OPEN_INODES_LOCK held, so that
+   other opens and closes need not wait for the disk.  If another
+   thread opens the inode meanwhile, its copy is used instead.  If
+   any inode is closed for the last time meanwhile, it may have
+   been this one, after writing a newer disk inode than the one
+   read, so the read is retried. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
-  struct inode *inode;
-
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
+  struct inode key;
+  struct hash_elem *e;
+  struct inode *inode = NULL;
+  unsigned gen = 0;
+
+  lock_acquire (&open_inodes_lock);
+  key.sector = sector;
+  for (;;)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
+      /* Check whether this inode is already open. */
+      e = hash_find (&open_inodes, &key.elem);
+      if (e != NULL)
         {
-          inode_reopen (inode);
-          return inode;
+          struct inode *open = hash_entry (e, struct inode, elem);
+          open->open_cnt++;
+          lock_release (&open_inodes_lock);
+          free (inode);
+          return open;
         }
-    }
+      if (inode != NULL && gen == close_gen)
+        break;
+      gen = close_gen;
+      lock_release (&open_inodes_lock);
 
-  /* Allocate memory. */
-  inode = malloc (sizeof *inode);
-  if (inode == NULL)
-    return NULL;
+      /* Allocate memory. */
+      if (inode == NULL)
+        {
+          inode = malloc (sizeof *inode);
+          if (inode == NULL)
+            return NULL;
+        }
+      cache_read (sector, &inode->data);
+      lock_acquire (&open_inodes_lock);
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  lock_init (&inode->lock);
+  rwlock_init (&inode->data_lock);
+  lock_init (&inode->meta_lock);
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +522,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -163,22 +543,31 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode)
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      hash_delete (&open_inodes, &inode->elem);
+      close_gen++;
+    }
+  lock_release (&open_inodes_lock);
 
+  if (last)
+    {
       /* Deallocate blocks if removed. */
       if (inode->removed)
         {
+          if (!is_inline (&inode->data))
+            release_sectors (&inode->data,
+                             bytes_to_sectors (inode->data.length));
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length));
         }
 
       free (inode);
@@ -191,18 +580,37 @@ void
 inode_remove (struct inode *inode)
 {
   ASSERT (inode != NULL);
+  lock_acquire (&inode->meta_lock);
   inode->removed = true;
+  lock_release (&inode->meta_lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   BUFFER must be kernel memory: it is filled with the inode's
+   data lock and buffer cache entries held, and a page fault on a
+   user page could need those same locks to page itself in. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+
+  ASSERT (size <= 0 || is_kernel_vaddr (buffer));
+
+  rwlock_acquire_read (&inode->data_lock);
+  if (is_inline (&inode->data))
+    {
+      if (offset >= inode->data.length)
+        size = 0;
+      else if (size > inode->data.length - offset)
+        size = inode->data.length - offset;
+      if (size > 0)
+        memcpy (buffer, inode->data.data + offset, size);
+      bytes_read = size;
+      size = 0;
+    }
 
   while (size > 0)
     {
@@ -211,7 +619,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = inode->data.length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -220,50 +628,92 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
+      if (sector_idx != 0)
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
       else
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+        memset (buffer + bytes_read, 0, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->data_lock);
 
   return bytes_read;
 }
 
+/* Starts reading the sectors that hold the SIZE bytes of INODE
+   at OFFSET into the buffer cache in the background, stopping at
+   end of file. */
+void
+inode_read_ahead (struct inode *inode, off_t size, off_t offset)
+{
+  off_t end = offset + size;
+  off_t pos;
+
+  lock_acquire (&inode->meta_lock);
+  if (end > inode->data.length)
+    end = inode->data.length;
+  if (!is_inline (&inode->data))
+    for (pos = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); pos < end;
+         pos += BLOCK_SECTOR_SIZE)
+      {
+        block_sector_t sector = byte_to_sector (inode, pos);
+        if (sector != 0)
+          cache_prefetch (sector);
+      }
+  lock_release (&inode->meta_lock);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up.  A write past end of file
+   extends the inode, leaving a hole in any gap.  Sectors are
+   allocated only for the bytes actually written, so if the disk
+   fills up the file keeps its new length and the unwritten part
+   reads as zeros.  As with inode_read_at(), BUFFER must be kernel
+   memory. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool inode_dirty = false;
 
-  if (inode->deny_write_cnt)
+  if (size <= 0)
     return 0;
+  ASSERT (is_kernel_vaddr (buffer));
+
+  rwlock_acquire_write (&inode->data_lock);
+  lock_acquire (&inode->meta_lock);
+  if (inode->deny_write_cnt)
+    size = 0;
+  else if (offset + size > inode->data.length)
+    {
+      /* Extend the file if writing past its end. */
+      if (offset + size > (off_t) MAX_SECTORS * BLOCK_SECTOR_SIZE
+          || (offset + size > INLINE_MAX && is_inline (&inode->data)
+              && !move_inline_data (&inode->data, inode->sector)))
+        size = 0;
+      else
+        {
+          inode->data.length = offset + size;
+          inode_dirty = true;
+        }
+    }
+
+  /* Inline data is at the start of the inode's sector. */
+  if (size > 0 && is_inline (&inode->data))
+    {
+      memcpy (inode->data.data + offset, buffer, size);
+      bytes_written = size;
+      inode_dirty = true;
+      size = 0;
+    }
+  lock_release (&inode->meta_lock);
 
   while (size > 0)
     {
@@ -272,7 +722,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = inode->data.length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -281,38 +731,35 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* Fill in a hole. */
+      if (sector_idx == 0)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          lock_acquire (&inode->meta_lock);
+          sector_idx = alloc_data_sector (&inode->data, inode->sector,
+                                          offset / BLOCK_SECTOR_SIZE,
+                                          chunk_size < BLOCK_SECTOR_SIZE);
+          lock_release (&inode->meta_lock);
+          if (sector_idx == 0)
+            break;
+          inode_dirty = true;
         }
-      else
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left)
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                      chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  if (inode_dirty)
+    {
+      lock_acquire (&inode->meta_lock);
+      cache_write (inode->sector, &inode->data);
+      lock_release (&inode->meta_lock);
+    }
+  rwlock_release_write (&inode->data_lock);
 
   return bytes_written;
 }
@@ -322,8 +769,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode)
 {
+  lock_acquire (&inode->meta_lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  lock_release (&inode->meta_lock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,14 +781,38 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode)
 {
+  lock_acquire (&inode->meta_lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  lock_release (&inode->meta_lock);
+}
+
+/* Acquires INODE's lock, which the inode code itself never takes.
+   The directory code holds it across each operation on a
+   directory, so that its entries and the directory entry cache
+   change together. */
+void
+inode_lock (struct inode *inode)
+{
+  lock_acquire (&inode->lock);
+}
+
+/* Releases INODE's lock. */
+void
+inode_unlock (struct inode *inode)
+{
+  lock_release (&inode->lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
 off_t
-inode_length (const struct inode *inode)
+inode_length (struct inode *inode)
 {
-  return inode->data.length;
+  off_t length;
+
+  lock_acquire (&inode->meta_lock);
+  length = inode->data.length;
+  lock_release (&inode->meta_lock);
+  return length;
 }
@@ -29,7 +29,16 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Homework 5. */
+    SYS_SBRK,                   /* Changes the end of the heap. */
+
+    /* Virtual memory statistics. */
+    SYS_WORKING_SET,            /* Reports a process's working set size. */
+
+    /* File system write-behind. */
+    SYS_FSYNC                   /* Writes a file's data to disk. */
   };
 
 #endif /* lib/syscall-nr.h */
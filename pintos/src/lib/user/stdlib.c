@@ -1,25 +1,418 @@
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+
+/* User memory allocator.
+
+   The heap is a contiguous run of blocks obtained with sbrk().
+   Every block starts with a header that records its own size,
+   whether it is in use, and the size of the block before it, so
+   that a freed block can be merged with both of its neighbors.
+
+   Free blocks are kept in segregated free lists ("bins") by
+   size class: one bin per 16 bytes for small blocks and one bin
+   per power of 2 above that.  malloc() takes the first block
+   that fits from the smallest bin that can hold the request,
+   splitting off any excess, and grows the heap only when no
+   free block fits.
+
+   realloc() grows a block in place when the block after it is
+   free or when it sits at the top of the heap.  A large free
+   block at the top of the heap is returned to the kernel with a
+   negative sbrk(). */
+
+/* A heap block.  Only the first two members are present in
+   blocks that are in use; the payload starts right after
+   them. */
+struct block
+  {
+    size_t prev_size;           /* Size of preceding block, 0 if first. */
+    size_t size;                /* Size of this block, including header,
+                                   plus IN_USE. */
+
+    /* Free blocks only. */
+    struct block *next_free;    /* Next block in bin. */
+    struct block *prev_free;    /* Previous block in bin. */
+  };
+
+/* Flag in struct block's SIZE for a block in use. */
+#define IN_USE ((size_t) 1)
+
+/* Size of a block header, alignment of every block, and size of
+   the smallest block. */
+#define HEADER_SIZE offsetof (struct block, next_free)
+#define ALIGNMENT 8
+#define MIN_BLOCK sizeof (struct block)
+
+/* Bins 0 to SMALL_BINS - 1 hold blocks smaller than
+   SMALL_LIMIT, one bin per SMALL_STEP bytes; the rest hold one
+   power of 2 each. */
+#define SMALL_STEP 16
+#define SMALL_LIMIT 256
+#define SMALL_BINS (SMALL_LIMIT / SMALL_STEP)
+#define BIN_CNT (SMALL_BINS + 24)
+
+/* A free block at the top of the heap at least this big is
+   given back to the kernel. */
+#define TRIM_THRESHOLD (16 * 1024)
+
+/* Free lists. */
+static struct block *bins[BIN_CNT];
+
+/* Bounds of the heap, and the size of its last block (0 if the
+   heap is empty). */
+static uint8_t *heap_start;
+static uint8_t *heap_end;
+static size_t last_size;
+
+static size_t
+block_size (const struct block *b)
+{
+  return b->size & ~IN_USE;
+}
+
+static bool
+block_is_free (const struct block *b)
+{
+  return (b->size & IN_USE) == 0;
+}
+
+static struct block *
+next_block (const struct block *b)
+{
+  return (struct block *) ((uint8_t *) b + block_size (b));
+}
+
+/* Returns the block after B, or a null pointer if B is the last
+   block in the heap. */
+static struct block *
+next_block_in_heap (const struct block *b)
+{
+  struct block *next = next_block (b);
+  return (uint8_t *) next < heap_end ? next : NULL;
+}
+
+/* Returns the block before B, or a null pointer if B is the
+   first block in the heap. */
+static struct block *
+prev_block (const struct block *b)
+{
+  if (b->prev_size == 0)
+    return NULL;
+  return (struct block *) ((uint8_t *) b - b->prev_size);
+}
+
+/* Returns the last block in the heap, or a null pointer if the
+   heap is empty. */
+static struct block *
+last_block (void)
+{
+  return last_size != 0 ? (struct block *) (heap_end - last_size) : NULL;
+}
+
+/* Sets B's size to SIZE and its in-use flag to IN_USE_, and
+   records SIZE in the header of the following block. */
+static void
+set_size (struct block *b, size_t size, bool in_use_)
+{
+  uint8_t *end = (uint8_t *) b + size;
+
+  b->size = size | (in_use_ ? IN_USE : 0);
+  if (end < heap_end)
+    ((struct block *) end)->prev_size = size;
+  else
+    last_size = size;
+}
+
+static void *
+block_payload (struct block *b)
+{
+  return (uint8_t *) b + HEADER_SIZE;
+}
+
+static struct block *
+payload_block (void *p)
+{
+  return (struct block *) ((uint8_t *) p - HEADER_SIZE);
+}
+
+/* Returns the size of the block needed to hold SIZE bytes of
+   payload, or 0 if SIZE is too big. */
+static size_t
+request_size (size_t size)
+{
+  size_t need;
+
+  if (size > SIZE_MAX - HEADER_SIZE - ALIGNMENT)
+    return 0;
+  need = (size + HEADER_SIZE + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1);
+  return need < MIN_BLOCK ? MIN_BLOCK : need;
+}
+
+/* Returns the bin for blocks of SIZE bytes. */
+static size_t
+bin_index (size_t size)
+{
+  size_t idx;
+
+  if (size < SMALL_LIMIT)
+    return size / SMALL_STEP;
+
+  idx = SMALL_BINS;
+  for (size /= SMALL_LIMIT; size > 1 && idx < BIN_CNT - 1; size >>= 1)
+    idx++;
+  return idx;
+}
+
+/* Adds free block B to its bin. */
+static void
+bin_insert (struct block *b)
+{
+  struct block **bin = &bins[bin_index (block_size (b))];
+
+  b->prev_free = NULL;
+  b->next_free = *bin;
+  if (*bin != NULL)
+    (*bin)->prev_free = b;
+  *bin = b;
+}
+
+/* Removes free block B from its bin. */
+static void
+bin_remove (struct block *b)
+{
+  if (b->prev_free != NULL)
+    b->prev_free->next_free = b->next_free;
+  else
+    bins[bin_index (block_size (b))] = b->next_free;
+  if (b->next_free != NULL)
+    b->next_free->prev_free = b->prev_free;
+}
+
+/* Returns the first free block of at least NEED bytes from the
+   smallest bin that has one, or a null pointer if there is
+   none.  The block is left in its bin. */
+static struct block *
+find_fit (size_t need)
+{
+  size_t i;
+
+  for (i = bin_index (need); i < BIN_CNT; i++)
+    {
+      struct block *b;
+
+      for (b = bins[i]; b != NULL; b = b->next_free)
+        if (block_size (b) >= need)
+          return b;
+    }
+  return NULL;
+}
+
+/* Extends the heap by SIZE bytes.  Returns the start of the new
+   space, or a null pointer if the kernel refuses. */
+static uint8_t *
+heap_grow (size_t size)
+{
+  uint8_t *p;
+
+  if (heap_start == NULL)
+    {
+      /* Align the start of the heap. */
+      uintptr_t brk = (uintptr_t) sbrk (0);
+      size_t pad = (ALIGNMENT - brk % ALIGNMENT) % ALIGNMENT;
+      if (pad > 0 && sbrk (pad) == (void *) -1)
+        return NULL;
+      heap_start = heap_end = (uint8_t *) brk + pad;
+    }
+
+  if (size > INTPTR_MAX)
+    return NULL;
+  p = sbrk (size);
+  if (p == (void *) -1)
+    return NULL;
+  heap_end = p + size;
+  return p;
+}
+
+/* Frees block B, merging it with free neighbors, and either
+   puts the result in a bin or, if it is a large block at the
+   top of the heap, gives it back to the kernel. */
+static void
+release_block (struct block *b)
+{
+  size_t size = block_size (b);
+  struct block *next = next_block_in_heap (b);
+  struct block *prev = prev_block (b);
+
+  if (next != NULL && block_is_free (next))
+    {
+      bin_remove (next);
+      size += block_size (next);
+    }
+  if (prev != NULL && block_is_free (prev))
+    {
+      bin_remove (prev);
+      size += block_size (prev);
+      b = prev;
+    }
+  set_size (b, size, false);
+
+  if ((uint8_t *) b + size == heap_end && size >= TRIM_THRESHOLD
+      && sbrk (-(intptr_t) size) != (void *) -1)
+    {
+      heap_end = (uint8_t *) b;
+      last_size = b->prev_size;
+      return;
+    }
+  bin_insert (b);
+}
+
+/* Marks block B, which is not in any bin, as in use with size
+   NEED, and frees whatever is left over if that is big enough
+   to be a block of its own. */
+static void
+split (struct block *b, size_t need)
+{
+  size_t size = block_size (b);
+
+  if (size - need >= MIN_BLOCK)
+    {
+      struct block *rest;
+
+      set_size (b, need, true);
+      rest = next_block (b);
+      set_size (rest, size - need, false);
+      release_block (rest);
+    }
+  else
+    set_size (b, size, true);
+}
+
+/* Obtains a block of NEED bytes at the top of the heap, reusing
+   the last block if it is free.  Returns a null pointer if the
+   heap cannot grow.  The block is not in any bin. */
+static struct block *
+grow_top (size_t need)
+{
+  struct block *top = last_block ();
+  struct block *b;
+
+  if (top != NULL && block_is_free (top))
+    {
+      if (heap_grow (need - block_size (top)) == NULL)
+        return NULL;
+      bin_remove (top);
+      set_size (top, need, false);
+      return top;
+    }
+
+  b = (struct block *) heap_grow (need);
+  if (b == NULL)
+    return NULL;
+  b->prev_size = last_size;
+  set_size (b, need, false);
+  return b;
+}
 
 void*
 malloc (size_t size)
 {
-  /* Homework 5, Part B: YOUR CODE HERE */
-  return NULL;
+  size_t need;
+  struct block *b;
+
+  if (size == 0)
+    return NULL;
+  need = request_size (size);
+  if (need == 0)
+    return NULL;
+
+  b = find_fit (need);
+  if (b != NULL)
+    bin_remove (b);
+  else
+    {
+      b = grow_top (need);
+      if (b == NULL)
+        return NULL;
+    }
+  split (b, need);
+  return block_payload (b);
 }
 
 void free (void* ptr)
 {
-  /* Homework 5, Part B: YOUR CODE HERE */
+  if (ptr != NULL)
+    release_block (payload_block (ptr));
 }
 
 void* calloc (size_t nmemb, size_t size)
 {
-  /* Homework 5, Part B: YOUR CODE HERE */
-  return NULL;
+  void *p;
+
+  if (size != 0 && nmemb > SIZE_MAX / size)
+    return NULL;
+  p = malloc (nmemb * size);
+  if (p != NULL)
+    memset (p, 0, nmemb * size);
+  return p;
 }
 
 void* realloc (void* ptr, size_t size)
 {
-  /* Homework 5, Part B: YOUR CODE HERE */
-  return NULL;
+  struct block *b, *next;
+  size_t need, have, avail;
+  void *p;
+
+  if (ptr == NULL)
+    return malloc (size);
+  if (size == 0)
+    {
+      free (ptr);
+      return NULL;
+    }
+  need = request_size (size);
+  if (need == 0)
+    return NULL;
+
+  b = payload_block (ptr);
+  have = block_size (b);
+  if (need <= have)
+    {
+      split (b, need);
+      return ptr;
+    }
+
+  /* Grow in place into a free block that follows. */
+  next = next_block_in_heap (b);
+  avail = have;
+  if (next != NULL && block_is_free (next))
+    {
+      avail += block_size (next);
+      if (avail >= need)
+        {
+          bin_remove (next);
+          set_size (b, avail, true);
+          split (b, need);
+          return ptr;
+        }
+    }
+
+  /* Grow in place at the top of the heap. */
+  if ((uint8_t *) b + avail == heap_end && heap_grow (need - avail) != NULL)
+    {
+      if (avail > have)
+        bin_remove (next);
+      set_size (b, need, true);
+      return ptr;
+    }
+
+  /* Move. */
+  p = malloc (size);
+  if (p == NULL)
+    return NULL;
+  memcpy (p, ptr, have - HEADER_SIZE);
+  free (ptr);
+  return p;
 }
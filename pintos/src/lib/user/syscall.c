@@ -194,6 +194,17 @@ inumber (int fd)
 void*
 sbrk (intptr_t increment)
 {
-  /* Homework 5, Part B: YOUR CODE HERE */
-  return NULL;
+  return (void *) syscall1 (SYS_SBRK, increment);
+}
+
+int
+working_set (void)
+{
+  return syscall0 (SYS_WORKING_SET);
+}
+
+bool
+fsync (int fd)
+{
+  return syscall1 (SYS_FSYNC, fd);
 }
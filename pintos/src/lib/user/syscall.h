@@ -50,4 +50,10 @@ int inumber (int fd);
 /* Homework 5, Part B. */
 void* sbrk (intptr_t increment);
 
+/* Virtual memory statistics. */
+int working_set (void);
+
+/* File system write-behind. */
+bool fsync (int fd);
+
 #endif /* lib/user/syscall.h */
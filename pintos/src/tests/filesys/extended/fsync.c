@@ -0,0 +1,22 @@
+/* Calls fsync() on an open file, which must succeed, and on a
+   closed and a never-opened file descriptor, which must fail. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  int fd;
+
+  CHECK (create ("foo", 0), "create \"foo\"");
+  CHECK ((fd = open ("foo")) > 1, "open \"foo\"");
+  CHECK (write (fd, "foobar", 6) == 6, "write \"foo\"");
+  CHECK (fsync (fd), "fsync \"foo\"");
+  msg ("close \"foo\"");
+  close (fd);
+
+  CHECK (!fsync (fd), "fsync closed fd (must fail)");
+  CHECK (!fsync (0x20101234), "fsync bad fd (must fail)");
+}
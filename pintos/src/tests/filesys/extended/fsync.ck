@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsync) begin
+(fsync) create "foo"
+(fsync) open "foo"
+(fsync) write "foo"
+(fsync) fsync "foo"
+(fsync) close "foo"
+(fsync) fsync closed fd (must fail)
+(fsync) fsync bad fd (must fail)
+(fsync) end
+EOF
+pass;
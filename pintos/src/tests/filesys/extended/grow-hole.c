@@ -0,0 +1,35 @@
+/* Writes data at the start of a file, seeks far past its end and
+   writes more, and checks that the gap in between, which spans
+   many whole sectors, reads back as zeros. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 20000
+#define DATA_SIZE 100
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void)
+{
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, DATA_SIZE);
+  random_bytes (buf + FILE_SIZE - DATA_SIZE, DATA_SIZE);
+
+  CHECK (create ("testfile", 0), "create \"testfile\"");
+  CHECK ((fd = open ("testfile")) > 1, "open \"testfile\"");
+  CHECK (write (fd, buf, DATA_SIZE) == DATA_SIZE, "write \"testfile\"");
+  msg ("seek \"testfile\"");
+  seek (fd, FILE_SIZE - DATA_SIZE);
+  CHECK (write (fd, buf + FILE_SIZE - DATA_SIZE, DATA_SIZE) == DATA_SIZE,
+         "write \"testfile\" past end");
+  msg ("close \"testfile\"");
+  close (fd);
+  check_file ("testfile", buf, FILE_SIZE);
+}
@@ -0,0 +1,52 @@
+/* Grows a file a few bytes at a time across the 504-byte limit
+   on data stored in its inode's sector, then removes it and
+   creates it again below the limit, checking its contents each
+   time. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BIG_SIZE 1200
+#define SMALL_SIZE 300
+
+static char buf[BIG_SIZE];
+
+/* Sizes of successive writes, straddling the limit. */
+static const size_t write_sizes[] = {500, 3, 1, 1, 7, 688};
+
+void
+test_main (void)
+{
+  size_t ofs = 0;
+  size_t i;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("testme", 0), "create \"testme\"");
+  CHECK ((fd = open ("testme")) > 1, "open \"testme\"");
+  msg ("grow \"testme\" to %d bytes", BIG_SIZE);
+  for (i = 0; i < sizeof write_sizes / sizeof *write_sizes; i++)
+    {
+      int retval = write (fd, buf + ofs, write_sizes[i]);
+      if (retval != (int) write_sizes[i])
+        fail ("write %zu bytes at offset %zu returned %d",
+              write_sizes[i], ofs, retval);
+      ofs += write_sizes[i];
+    }
+  msg ("close \"testme\"");
+  close (fd);
+  check_file ("testme", buf, BIG_SIZE);
+
+  CHECK (remove ("testme"), "remove \"testme\"");
+  CHECK (create ("testme", 0), "create \"testme\"");
+  CHECK ((fd = open ("testme")) > 1, "open \"testme\"");
+  CHECK (write (fd, buf, SMALL_SIZE) == SMALL_SIZE,
+         "write %d bytes to \"testme\"", SMALL_SIZE);
+  msg ("close \"testme\"");
+  close (fd);
+  check_file ("testme", buf, SMALL_SIZE);
+}
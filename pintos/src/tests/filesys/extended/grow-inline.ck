@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-inline) begin
+(grow-inline) create "testme"
+(grow-inline) open "testme"
+(grow-inline) grow "testme" to 1200 bytes
+(grow-inline) close "testme"
+(grow-inline) open "testme" for verification
+(grow-inline) verified contents of "testme"
+(grow-inline) close "testme"
+(grow-inline) remove "testme"
+(grow-inline) create "testme"
+(grow-inline) open "testme"
+(grow-inline) write 300 bytes to "testme"
+(grow-inline) close "testme"
+(grow-inline) open "testme" for verification
+(grow-inline) verified contents of "testme"
+(grow-inline) close "testme"
+(grow-inline) end
+EOF
+pass;
@@ -0,0 +1,140 @@
+/* Times reads from many pages of the kernel's direct map of
+   physical memory, first through the page directory built by
+   paging_init(), which maps RAM with 4 MB pages where the CPU
+   supports them, and then through a copy of the same mapping
+   that uses only 4 kB pages.  Reports the average cost of a read
+   under each, and checks that both mappings see the same
+   memory.
+
+   Run with more than 4 MB of RAM: only 4 MB regions that do not
+   hold kernel text get large pages. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+
+/* Number of passes over the direct map per measurement. */
+#define ROUNDS 16
+
+static uint32_t *create_small_page_dir (void);
+static void destroy_small_page_dir (uint32_t *pd);
+static uint64_t time_reads (uint32_t *pd, uint32_t *sum);
+
+void
+test_paging_pse (void)
+{
+  uint32_t *small_pd;
+  uint64_t large_cycles, small_cycles;
+  uint32_t large_sum, small_sum;
+  size_t large_cnt = 0;
+  size_t reads = (size_t) init_ram_pages * ROUNDS;
+  size_t i;
+
+  for (i = 0; i < pd_no (PHYS_BASE + init_ram_pages * PGSIZE); i++)
+    if (init_page_dir[i] & PTE_PS)
+      large_cnt++;
+  msg ("%zu MB of RAM mapped with 4 MB pages.", large_cnt * (PTSPAN >> 20));
+
+  small_pd = create_small_page_dir ();
+  if (small_pd == NULL)
+    fail ("out of memory building 4 kB page tables");
+
+  large_cycles = time_reads (init_page_dir, &large_sum);
+  small_cycles = time_reads (small_pd, &small_sum);
+  destroy_small_page_dir (small_pd);
+
+  if (large_sum != small_sum)
+    fail ("mappings disagree: checksum %"PRIx32" vs. %"PRIx32,
+          large_sum, small_sum);
+
+  msg ("initial mapping: %"PRIu64" cycles per page read.",
+       large_cycles / reads);
+  msg ("4 kB pages only: %"PRIu64" cycles per page read.",
+       small_cycles / reads);
+  pass ();
+}
+
+/* Returns a new page directory that maps all of RAM into kernel
+   virtual memory, as init_page_dir does, but with 4 kB pages
+   only.  Returns a null pointer if memory runs out. */
+static uint32_t *
+create_small_page_dir (void)
+{
+  uint32_t *pd, *pt = NULL;
+  size_t page;
+
+  pd = palloc_get_page (PAL_ZERO);
+  if (pd == NULL)
+    return NULL;
+  for (page = 0; page < init_ram_pages; page++)
+    {
+      void *vaddr = ptov (page * PGSIZE);
+      size_t pde_idx = pd_no (vaddr);
+
+      if (pd[pde_idx] == 0)
+        {
+          pt = palloc_get_page (PAL_ZERO);
+          if (pt == NULL)
+            {
+              destroy_small_page_dir (pd);
+              return NULL;
+            }
+          pd[pde_idx] = pde_create (pt);
+        }
+      pt[pt_no (vaddr)] = pte_create_kernel (vaddr, true);
+    }
+  return pd;
+}
+
+/* Frees PD and its page tables. */
+static void
+destroy_small_page_dir (uint32_t *pd)
+{
+  size_t i;
+
+  for (i = 0; i < PGSIZE / sizeof *pd; i++)
+    if (pd[i] & PTE_P)
+      palloc_free_page (pde_get_pt (pd[i]));
+  palloc_free_page (pd);
+}
+
+/* Returns the time stamp counter. */
+static uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Makes PD the active page directory, reads one word from every
+   page of RAM ROUNDS times, and switches back to init_page_dir.
+   Stores the sum of the words read in *SUM and returns the
+   number of cycles the reads took.  Interrupts are off
+   throughout, so nothing else runs on PD. */
+static uint64_t
+time_reads (uint32_t *pd, uint32_t *sum)
+{
+  enum intr_level old_level = intr_disable ();
+  uint64_t start, end;
+  uint32_t total = 0;
+  size_t round, page;
+
+  asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
+  start = rdtsc ();
+  for (round = 0; round < ROUNDS; round++)
+    for (page = 0; page < init_ram_pages; page++)
+      total += *(volatile uint32_t *) ptov (page * PGSIZE);
+  end = rdtsc ();
+  asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)) : "memory");
+  intr_set_level (old_level);
+
+  *sum = total;
+  return end - start;
+}
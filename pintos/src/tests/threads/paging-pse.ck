@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+@output = get_core_output ("run", @output);
+fail "missing PASS in output"
+  unless grep ($_ eq '(paging-pse) PASS', @output);
+fail "no RAM was mapped with 4 MB pages"
+  if grep (/^\(paging-pse\) 0 MB of RAM mapped with 4 MB pages\.$/, @output);
+foreach my $kind ('initial mapping', '4 kB pages only') {
+    fail "missing timing for \"$kind\""
+      unless grep (/^\(paging-pse\) $kind: \d+ cycles per page read\.$/,
+		   @output);
+}
+
+pass;
@@ -0,0 +1,52 @@
+/* Touches PAGE_CNT pages and checks that working_set() counts
+   them, then idles until they age out of the working set. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 64
+
+/* Number of busy-wait passes to try before giving up.  The
+   kernel samples accessed bits 4 times a second and forgets a
+   page after 8 samples without an access. */
+#define IDLE_TRIES 2000
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+/* Burns some CPU time without touching BUF. */
+static void
+spin (void)
+{
+  volatile int i;
+
+  for (i = 0; i < (1 << 20); i++)
+    continue;
+}
+
+void
+test_main (void)
+{
+  int ws;
+  int try;
+  size_t i;
+
+  msg ("touch %d pages", PAGE_CNT);
+  for (i = 0; i < PAGE_CNT; i++)
+    buf[i * PAGE_SIZE] = i;
+
+  ws = working_set ();
+  if (ws < PAGE_CNT)
+    fail ("working set of %d pages after touching %d", ws, PAGE_CNT);
+  msg ("working set includes touched pages");
+
+  msg ("idle");
+  for (try = 0; (ws = working_set ()) >= PAGE_CNT / 2; try++)
+    {
+      if (try >= IDLE_TRIES)
+        fail ("working set still %d pages after idling", ws);
+      spin ();
+    }
+  msg ("working set shrank");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(working-set) begin
+(working-set) touch 64 pages
+(working-set) working set includes touched pages
+(working-set) idle
+(working-set) working set shrank
+(working-set) end
+EOF
+pass;
@@ -148,6 +148,26 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of pages in the user pool. */
+size_t
+palloc_user_page_cnt (void)
+{
+  return bitmap_size (user_pool.used_map);
+}
+
+/* Returns the number of free pages in the user pool. */
+size_t
+palloc_user_free_cnt (void)
+{
+  size_t cnt;
+
+  lock_acquire (&user_pool.lock);
+  cnt = bitmap_count (user_pool.used_map, 0,
+                      bitmap_size (user_pool.used_map), false);
+  lock_release (&user_pool.lock);
+  return cnt;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
@@ -1,9 +1,14 @@
 #include "userprog/exception.h"
 #include <inttypes.h>
+#include <debug.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -148,9 +153,24 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
+#ifdef VM
+  /* Bring in the page to which fault_addr refers, if it is part
+     of the process's address space.  This applies to kernel
+     accesses to user memory too, e.g. from system calls, for
+     which the user stack pointer was saved by the system call
+     handler. */
+  if (not_present
+      && page_fault_in (fault_addr,
+                        user ? f->esp : thread_current ()->user_esp))
+    return;
+#endif
+
+  /* System calls check user pointers before taking any lock, so
+     the kernel should never fault on a bad one.  Killing the
+     process here would leave whatever it holds locked forever. */
+  if (!user && is_user_vaddr (fault_addr) && thread_current ()->pagedir != NULL)
+    PANIC ("unchecked user pointer %p dereferenced by kernel", fault_addr);
+
   printf ("Page fault at %p: %s error %s page in %s context.\n",
           fault_addr,
           not_present ? "not present" : "rights violation",
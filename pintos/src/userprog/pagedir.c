@@ -7,18 +7,29 @@
 #include "threads/palloc.h"
 
 static uint32_t *active_pd (void);
-static void invalidate_pagedir (uint32_t *);
+static void load_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
    Returns the new page directory, or a null pointer if memory
-   allocation fails. */
+   allocation fails.
+
+   Only the kernel half of init_page_dir is copied.  Its entries
+   point to page tables or 4 MB pages shared by every page
+   directory, so no page tables are copied. */
 uint32_t *
 pagedir_create (void)
 {
   uint32_t *pd = palloc_get_page (0);
   if (pd != NULL)
-    memcpy (pd, init_page_dir, PGSIZE);
+    {
+      size_t kernel_pde = pd_no (PHYS_BASE);
+
+      memset (pd, 0, kernel_pde * sizeof *pd);
+      memcpy (pd + kernel_pde, init_page_dir + kernel_pde,
+              PGSIZE - kernel_pde * sizeof *pd);
+    }
   return pd;
 }
 
@@ -136,6 +147,19 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
     return NULL;
 }
 
+/* Returns true if user virtual address UADDR is mapped writable
+   in PD, false if it is read-only or unmapped. */
+bool
+pagedir_is_writable (uint32_t *pd, const void *uaddr)
+{
+  uint32_t *pte;
+
+  ASSERT (is_user_vaddr (uaddr));
+
+  pte = lookup_page (pd, uaddr, false);
+  return pte != NULL && (*pte & PTE_P) != 0 && (*pte & PTE_W) != 0;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
    directory PD.  Later accesses to the page will fault.  Other
    bits in the page table entry are preserved.
@@ -152,7 +176,7 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
@@ -180,7 +204,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -209,25 +233,79 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else
         {
           *pte &= ~(uint32_t) PTE_A;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
 
 /* Loads page directory PD into the CPU's page directory base
-   register. */
+   register.  Does nothing if PD is already active, e.g. when
+   switching between kernel threads, which all use
+   init_page_dir. */
 void
 pagedir_activate (uint32_t *pd)
 {
   if (pd == NULL)
     pd = init_page_dir;
 
-  /* Store the physical address of the page directory into CR3
-     aka PDBR (page directory base register).  This activates our
-     new page tables immediately.  See [IA32-v2a] "MOV--Move
-     to/from Control Registers" and [IA32-v3a] 3.7.5 "Base
-     Address of the Page Directory". */
-  asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
+  if (active_pd () != pd)
+    load_pagedir (pd);
+}
+
+/* Initializes BATCH for clearing pages in page directory PD. */
+void
+pagedir_batch_init (struct pagedir_batch *batch, uint32_t *pd)
+{
+  batch->pd = pd;
+  batch->cnt = 0;
+}
+
+/* Marks user virtual page UPAGE "not present" in BATCH's page
+   directory, like pagedir_clear_page(), but leaves the TLB
+   alone until pagedir_batch_flush().
+
+   Until then the CPU may still use the old mapping, so the
+   caller must not touch UPAGE in the meantime.  Freeing the
+   frame before the flush is safe on our uniprocessor: any other
+   process that gets the frame runs with a different page
+   directory, and switching to it reloads CR3. */
+void
+pagedir_batch_clear_page (struct pagedir_batch *batch, void *upage)
+{
+  uint32_t *pte;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  pte = lookup_page (batch->pd, upage, false);
+  if (pte != NULL && (*pte & PTE_P) != 0)
+    {
+      *pte &= ~PTE_P;
+      if (batch->cnt < PAGEDIR_BATCH_MAX)
+        batch->pages[batch->cnt] = upage;
+      batch->cnt++;
+    }
+}
+
+/* Invalidates the TLB entries for every page cleared in BATCH,
+   one page at a time for a small batch or with a full flush for
+   a large one, and empties BATCH. */
+void
+pagedir_batch_flush (struct pagedir_batch *batch)
+{
+  if (batch->cnt > PAGEDIR_BATCH_MAX)
+    {
+      if (active_pd () == batch->pd)
+        load_pagedir (batch->pd);
+    }
+  else
+    {
+      size_t i;
+
+      for (i = 0; i < batch->cnt; i++)
+        invalidate_page (batch->pd, batch->pages[i]);
+    }
+  batch->cnt = 0;
 }
 
 /* Returns the currently active page directory. */
@@ -243,21 +321,32 @@ active_pd (void)
   return ptov (pd);
 }
 
-/* Seom page table changes can cause the CPU's translation
+/* Loads PD into CR3, which also flushes the whole TLB. */
+static void
+load_pagedir (uint32_t *pd)
+{
+  /* Store the physical address of the page directory into CR3
+     aka PDBR (page directory base register).  This activates our
+     new page tables immediately.  See [IA32-v2a] "MOV--Move
+     to/from Control Registers" and [IA32-v3a] 3.7.5 "Base
+     Address of the Page Directory". */
+  asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
+}
+
+/* Some page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
+   table.  When this happens, we have to "invalidate" the TLB
+   entry for the page that changed.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   This function invalidates the TLB entry for VADDR if PD is
+   the active page directory.  (If PD is not active then its
+   entries are not in the TLB, so there is no need to invalidate
+   anything.)  INVLPG drops just that one entry, instead of the
+   whole TLB as reloading CR3 would.  See [IA32-v2a] "INVLPG--
+   Invalidate TLB Entry". */
 static void
-invalidate_pagedir (uint32_t *pd)
+invalidate_page (uint32_t *pd, const void *vaddr)
 {
   if (active_pd () == pd)
-    {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
-    }
+    asm volatile ("invlpg (%0)" : : "r" (vaddr) : "memory");
 }
@@ -2,12 +2,27 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/* Maximum number of pages that a batch invalidates one by one.
+   Past this, reloading CR3 to flush the whole TLB is cheaper. */
+#define PAGEDIR_BATCH_MAX 32
+
+/* A set of pages in one page directory whose mappings are
+   removed together, with a single TLB flush at the end. */
+struct pagedir_batch
+  {
+    uint32_t *pd;                       /* Page directory. */
+    size_t cnt;                         /* Number of pages cleared. */
+    const void *pages[PAGEDIR_BATCH_MAX]; /* First pages cleared. */
+  };
+
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
+bool pagedir_is_writable (uint32_t *pd, const void *upage);
 void pagedir_clear_page (uint32_t *pd, void *upage);
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
@@ -15,4 +30,8 @@ bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
 void pagedir_activate (uint32_t *pd);
 
+void pagedir_batch_init (struct pagedir_batch *, uint32_t *pd);
+void pagedir_batch_clear_page (struct pagedir_batch *, void *upage);
+void pagedir_batch_flush (struct pagedir_batch *);
+
 #endif /* userprog/pagedir.h */
@@ -1,8 +1,20 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "devices/shutdown.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 static void syscall_handler (struct intr_frame *);
 
@@ -12,10 +24,269 @@ syscall_init (void)
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
+/* Terminates the current process with exit code STATUS. */
+void
+syscall_exit (int status)
+{
+  printf ("%s: exit(%d)\n", thread_current ()->name, status);
+  thread_exit ();
+}
+
+/* Checks that the LENGTH bytes at BUFFER lie entirely below
+   PHYS_BASE.  Terminates the process if not. */
+static void
+validate_buffer_in_user_region (const void *buffer, size_t length)
+{
+  uintptr_t delta = PHYS_BASE - buffer;
+  if (!is_user_vaddr (buffer) || length > delta)
+    syscall_exit (-1);
+}
+
+/* Returns true if the page containing user address UADDR is part
+   of the current process's address space, and writable if WRITE
+   is true.  Under VM, the page is also made resident, so a later
+   access faults only if it has been evicted again, in which case
+   page_fault() brings it straight back. */
+static bool
+user_page_ok (const void *uaddr, bool write)
+{
+#ifdef VM
+  struct page *p = page_lookup (uaddr);
+  if (p == NULL)
+    {
+      if (!page_fault_in (uaddr, thread_current ()->user_esp))
+        return false;
+      p = page_lookup (uaddr);
+    }
+  else if (!page_load (p))
+    return false;
+  return p != NULL && (!write || p->writable);
+#else
+  uint32_t *pd = thread_current ()->pagedir;
+  return (pagedir_get_page (pd, uaddr) != NULL
+          && (!write || pagedir_is_writable (pd, uaddr)));
+#endif
+}
+
+/* Checks that every page of the LENGTH bytes at BUFFER belongs to
+   the current process, and is writable if WRITE is true.
+   Terminates the process if not.
+
+   This must run before the system call takes any lock: a process
+   killed from inside page_fault() would die holding it. */
+static void
+validate_user (const void *buffer, size_t length, bool write)
+{
+  const uint8_t *end = (const uint8_t *) buffer + length;
+  const uint8_t *page;
+
+  if (length == 0)
+    return;
+  validate_buffer_in_user_region (buffer, length);
+  for (page = pg_round_down (buffer); page < end; page += PGSIZE)
+    if (!user_page_ok (page, write))
+      syscall_exit (-1);
+}
+
+/* Copies the null-terminated user string STRING into a new page
+   and returns it.  Terminates the process if STRING is not
+   readable up to its null terminator.  Returns a null pointer if
+   STRING does not fit in a page or no page is available; the
+   caller must free the page with palloc_free_page(). */
+static char *
+copy_in_string (const char *string)
+{
+  char *copy;
+  size_t i;
+
+  for (i = 0; ; i++)
+    {
+      if (i == 0 || pg_ofs (string + i) == 0)
+        validate_user (string + i, 1, false);
+      if (string[i] == '\0')
+        break;
+    }
+  if (i >= PGSIZE)
+    return NULL;
+
+  copy = palloc_get_page (0);
+  if (copy != NULL)
+    memcpy (copy, string, i + 1);
+  return copy;
+}
+
+/* Returns the open file for FD in the current process, or a null
+   pointer if FD is not open. */
+static struct file *
+lookup_fd (int fd)
+{
+  if (fd < 2 || fd >= FD_MAX + 2)
+    return NULL;
+  return thread_current ()->files[fd - 2];
+}
+
+static bool
+syscall_create (const char *filename, unsigned initial_size)
+{
+  char *name = copy_in_string (filename);
+  bool success;
+
+  if (name == NULL)
+    return false;
+  success = filesys_create (name, initial_size);
+  palloc_free_page (name);
+  return success;
+}
+
+static bool
+syscall_remove (const char *filename)
+{
+  char *name = copy_in_string (filename);
+  bool success;
+
+  if (name == NULL)
+    return false;
+  success = filesys_remove (name);
+  palloc_free_page (name);
+  return success;
+}
+
+static int
+syscall_open (const char *filename)
+{
+  struct thread *t = thread_current ();
+  char *name = copy_in_string (filename);
+  int fd;
+
+  if (name == NULL)
+    return -1;
+  for (fd = 0; fd < FD_MAX; fd++)
+    if (t->files[fd] == NULL)
+      {
+        t->files[fd] = filesys_open (name);
+        palloc_free_page (name);
+        return t->files[fd] != NULL ? fd + 2 : -1;
+      }
+  palloc_free_page (name);
+  return -1;
+}
+
+static int
+syscall_filesize (int fd)
+{
+  struct file *file = lookup_fd (fd);
+  return file != NULL ? file_length (file) : -1;
+}
+
+/* File and console data pass through a kernel page, one page at
+   a time, so that file_read(), file_write() and putbuf() never
+   touch user memory.  A page fault there would be taken with a
+   buffer cache entry, an inode or the console locked, and could
+   recurse into the same lock if the user buffer is mapped from
+   the file being accessed.  The user side of each copy happens
+   with no lock held. */
+
+static int
+syscall_read (int fd, void *buffer, unsigned size)
+{
+  struct file *file = lookup_fd (fd);
+  uint8_t *bounce;
+  unsigned total = 0;
+
+  if (file == NULL || (bounce = palloc_get_page (0)) == NULL)
+    return -1;
+  while (total < size)
+    {
+      off_t chunk = size - total < PGSIZE ? size - total : PGSIZE;
+      off_t n = file_read (file, bounce, chunk);
+      memcpy ((uint8_t *) buffer + total, bounce, n);
+      total += n;
+      if (n < chunk)
+        break;
+    }
+  palloc_free_page (bounce);
+  return total;
+}
+
+static int
+syscall_write (int fd, const void *buffer, unsigned size)
+{
+  struct file *file = NULL;
+  uint8_t *bounce;
+  unsigned total = 0;
+
+  if (fd != STDOUT_FILENO && (file = lookup_fd (fd)) == NULL)
+    return -1;
+  if ((bounce = palloc_get_page (0)) == NULL)
+    return -1;
+  while (total < size)
+    {
+      off_t chunk = size - total < PGSIZE ? size - total : PGSIZE;
+      off_t n = chunk;
+      memcpy (bounce, (const uint8_t *) buffer + total, chunk);
+      if (file != NULL)
+        n = file_write (file, bounce, chunk);
+      else
+        putbuf ((const char *) bounce, chunk);
+      total += n;
+      if (n < chunk)
+        break;
+    }
+  palloc_free_page (bounce);
+  return total;
+}
+
+/* Positions too large for an off_t are ignored. */
+static void
+syscall_seek (int fd, unsigned position)
+{
+  struct file *file = lookup_fd (fd);
+  if (file != NULL && (off_t) position >= 0)
+    file_seek (file, position);
+}
+
+static unsigned
+syscall_tell (int fd)
+{
+  struct file *file = lookup_fd (fd);
+  return file != NULL ? (unsigned) file_tell (file) : 0;
+}
+
+static void
+syscall_close (int fd)
+{
+  struct file *file = lookup_fd (fd);
+  if (file != NULL)
+    {
+      file_close (file);
+      thread_current ()->files[fd - 2] = NULL;
+    }
+}
+
+/* Writes modified data to disk.  Everything dirty in the buffer
+   cache is written, not just FD's data. */
+static bool
+syscall_fsync (int fd)
+{
+  if (lookup_fd (fd) == NULL)
+    return false;
+  filesys_sync ();
+  return true;
+}
+
+#ifdef VM
+static int
+syscall_mmap (int fd, void *addr)
+{
+  struct file *file = lookup_fd (fd);
+  return file != NULL ? mmap_map (file, addr) : MAP_FAILED;
+}
+#endif
+
 static void
-syscall_handler (struct intr_frame *f UNUSED)
+syscall_handler (struct intr_frame *f)
 {
-  uint32_t* args = ((uint32_t*) f->esp);
+  uint32_t *args = (uint32_t *) f->esp;
 
   /*
    * The following print statement, if uncommented, will print out the syscall
@@ -26,10 +297,98 @@ syscall_handler (struct intr_frame *f UNUSED)
 
   /* printf("System call number: %d\n", args[0]); */
 
-  if (args[0] == SYS_EXIT)
+#ifdef VM
+  thread_current ()->user_esp = f->esp;
+#endif
+  validate_user (args, sizeof (uint32_t), false);
+  switch (args[0])
     {
+    case SYS_HALT:
+      shutdown_power_off ();
+
+    case SYS_EXIT:
+      validate_user (&args[1], sizeof (uint32_t), false);
       f->eax = args[1];
-      printf ("%s: exit(%d)\n", &thread_current ()->name, args[1]);
-      thread_exit ();
+      syscall_exit ((int) args[1]);
+      break;
+
+    case SYS_CREATE:
+      validate_user (&args[1], 2 * sizeof (uint32_t), false);
+      f->eax = syscall_create ((char *) args[1], (unsigned) args[2]);
+      break;
+
+    case SYS_REMOVE:
+      validate_user (&args[1], sizeof (uint32_t), false);
+      f->eax = syscall_remove ((char *) args[1]);
+      break;
+
+    case SYS_OPEN:
+      validate_user (&args[1], sizeof (uint32_t), false);
+      f->eax = (uint32_t) syscall_open ((char *) args[1]);
+      break;
+
+    case SYS_FILESIZE:
+      validate_user (&args[1], sizeof (uint32_t), false);
+      f->eax = (uint32_t) syscall_filesize ((int) args[1]);
+      break;
+
+    case SYS_READ:
+      validate_user (&args[1], 3 * sizeof (uint32_t), false);
+      validate_user ((void *) args[2], (unsigned) args[3], true);
+      f->eax = (uint32_t) syscall_read ((int) args[1], (void *) args[2],
+                                        (unsigned) args[3]);
+      break;
+
+    case SYS_WRITE:
+      validate_user (&args[1], 3 * sizeof (uint32_t), false);
+      validate_user ((void *) args[2], (unsigned) args[3], false);
+      f->eax = (uint32_t) syscall_write ((int) args[1], (void *) args[2],
+                                         (unsigned) args[3]);
+      break;
+
+    case SYS_SEEK:
+      validate_user (&args[1], 2 * sizeof (uint32_t), false);
+      syscall_seek ((int) args[1], (unsigned) args[2]);
+      break;
+
+    case SYS_TELL:
+      validate_user (&args[1], sizeof (uint32_t), false);
+      f->eax = syscall_tell ((int) args[1]);
+      break;
+
+    case SYS_CLOSE:
+      validate_user (&args[1], sizeof (uint32_t), false);
+      syscall_close ((int) args[1]);
+      break;
+
+    case SYS_FSYNC:
+      validate_user (&args[1], sizeof (uint32_t), false);
+      f->eax = syscall_fsync ((int) args[1]);
+      break;
+
+#ifdef VM
+    case SYS_MMAP:
+      validate_user (&args[1], 2 * sizeof (uint32_t), false);
+      f->eax = (uint32_t) syscall_mmap ((int) args[1], (void *) args[2]);
+      break;
+
+    case SYS_MUNMAP:
+      validate_user (&args[1], sizeof (uint32_t), false);
+      mmap_unmap ((int) args[1]);
+      break;
+
+    case SYS_SBRK:
+      validate_user (&args[1], sizeof (uint32_t), false);
+      f->eax = (uint32_t) page_sbrk ((intptr_t) args[1]);
+      break;
+
+    case SYS_WORKING_SET:
+      f->eax = (uint32_t) frame_working_set (thread_current ());
+      break;
+#endif
+
+    default:
+      printf ("Unimplemented system call: %d\n", (int) args[0]);
+      break;
     }
 }
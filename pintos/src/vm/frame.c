@@ -0,0 +1,354 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* Frame table.
+
+   Every user pool page that holds a process's page is tracked
+   here.  When the user pool is exhausted, frame_alloc() takes a
+   frame away from some page chosen by the second-chance "clock"
+   algorithm, using the accessed bits in the owning processes'
+   page directories.
+
+   A low-priority "reclaim" thread also samples the accessed
+   bits every AGE_INTERVAL ticks and folds them into a per-frame
+   aging counter, an approximation of LRU.  When the user pool
+   runs low, it evicts frames that have gone unused for several
+   intervals, so that page faults usually find a free page
+   instead of waiting for a victim to be written out. */
+
+/* Ticks between samples of the accessed bits. */
+#define AGE_INTERVAL (TIMER_FREQ / 4)
+
+/* Top bit of a frame's age: accessed in the latest interval. */
+#define AGE_RECENT 0x80
+
+/* The reclaim thread starts evicting cold frames when fewer
+   than RECLAIM_LOW user pool pages are free and stops once
+   RECLAIM_HIGH are free. */
+#define RECLAIM_LOW 16
+#define RECLAIM_HIGH 32
+
+/* All frames, in clock order. */
+static struct list frames;
+static size_t frame_cnt;
+
+/* Clock hand: the next frame to consider for eviction. */
+static struct list_elem *hand;
+
+/* Pages promised to processes but not yet created, e.g. heap
+   pages obtained with sbrk(), and the most that may be promised:
+   the size of the user pool plus swap, less RESERVE_SLACK pages
+   left for code, stacks, and other pages that are not
+   reserved. */
+static size_t reserved_cnt;
+static size_t reserve_limit;
+#define RESERVE_SLACK 64
+
+/* Protects FRAMES, FRAME_CNT, HAND, and RESERVED_CNT. */
+static struct lock frame_lock;
+
+static struct frame *frame_evict (struct page *);
+static struct frame *clock_select (void);
+static struct frame *reclaim_select (void);
+static uint8_t age_frame (struct frame *);
+static void reclaim (void *aux);
+
+/* Initializes the frame table.  Must be called after
+   swap_init(). */
+void
+frame_init (void)
+{
+  size_t capacity = palloc_user_page_cnt () + swap_slot_cnt ();
+
+  list_init (&frames);
+  lock_init (&frame_lock);
+  hand = NULL;
+  reserve_limit = capacity > RESERVE_SLACK ? capacity - RESERVE_SLACK : 0;
+  thread_create ("reclaim", PRI_MIN, reclaim, NULL);
+}
+
+/* Obtains a frame for page P, which must be locked by the
+   caller, evicting another page if the user pool is empty.
+   Returns the frame, or a null pointer if no frame can be
+   obtained. */
+struct frame *
+frame_alloc (struct page *p)
+{
+  struct frame *f;
+  void *kpage;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  kpage = palloc_get_page (PAL_USER);
+  if (kpage == NULL)
+    return frame_evict (p);
+
+  f = malloc (sizeof *f);
+  if (f == NULL)
+    {
+      palloc_free_page (kpage);
+      return NULL;
+    }
+  f->kpage = kpage;
+  f->page = p;
+  f->age = AGE_RECENT;
+
+  lock_acquire (&frame_lock);
+  list_push_back (&frames, &f->elem);
+  frame_cnt++;
+  lock_release (&frame_lock);
+  return f;
+}
+
+/* Removes frame F from the frame table and returns its page to
+   the user pool.  The page in F must already be unmapped. */
+void
+frame_free (struct frame *f)
+{
+  lock_acquire (&frame_lock);
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  list_remove (&f->elem);
+  frame_cnt--;
+  lock_release (&frame_lock);
+
+  palloc_free_page (f->kpage);
+  free (f);
+}
+
+/* Reserves memory for PAGE_CNT pages that will be created on
+   demand, so that a process runs out of memory when it asks for
+   memory rather than later, when it first touches it.
+   Returns true if successful, false if that would promise more
+   memory than the user pool and swap together can hold. */
+bool
+frame_reserve (size_t page_cnt)
+{
+  bool success;
+
+  lock_acquire (&frame_lock);
+  success = page_cnt <= reserve_limit - reserved_cnt;
+  if (success)
+    reserved_cnt += page_cnt;
+  lock_release (&frame_lock);
+  return success;
+}
+
+/* Releases a reservation of PAGE_CNT pages made with
+   frame_reserve(). */
+void
+frame_unreserve (size_t page_cnt)
+{
+  lock_acquire (&frame_lock);
+  ASSERT (reserved_cnt >= page_cnt);
+  reserved_cnt -= page_cnt;
+  lock_release (&frame_lock);
+}
+
+/* Takes a frame away from another page and hands it to P.
+   Returns the frame, or a null pointer if no page could be
+   evicted. */
+static struct frame *
+frame_evict (struct page *p)
+{
+  struct frame *f;
+  struct page *victim;
+  bool evicted;
+
+  lock_acquire (&frame_lock);
+  f = clock_select ();
+  if (f == NULL)
+    {
+      lock_release (&frame_lock);
+      return NULL;
+    }
+  victim = f->page;
+  f->page = p;
+  f->age = AGE_RECENT;
+  lock_release (&frame_lock);
+
+  /* Write out the victim without holding the frame table lock.
+     F is safe from other evictors because P is locked. */
+  evicted = page_evict (victim);
+  if (!evicted)
+    {
+      lock_acquire (&frame_lock);
+      f->page = victim;
+      lock_release (&frame_lock);
+    }
+  lock_release (&victim->lock);
+  return evicted ? f : NULL;
+}
+
+/* Returns the number of frames held by T's pages that have been
+   accessed in the last 8 aging intervals, T's working set. */
+size_t
+frame_working_set (struct thread *t)
+{
+  struct list_elem *e;
+  size_t cnt = 0;
+
+  lock_acquire (&frame_lock);
+  for (e = list_begin (&frames); e != list_end (&frames); e = list_next (e))
+    {
+      struct frame *f = list_entry (e, struct frame, elem);
+      struct page *p = f->page;
+
+      if (p->thread == t
+          && (f->age != 0 || pagedir_is_accessed (t->pagedir, p->upage)))
+        cnt++;
+    }
+  lock_release (&frame_lock);
+  return cnt;
+}
+
+/* Shifts frame F's age right by one, moving the page's accessed
+   bit into the top bit, and clears the accessed bit.  Returns
+   the new age.  F's page must be locked. */
+static uint8_t
+age_frame (struct frame *f)
+{
+  struct page *p = f->page;
+  uint32_t *pd = p->thread->pagedir;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  f->age >>= 1;
+  if (pagedir_is_accessed (pd, p->upage))
+    {
+      f->age |= AGE_RECENT;
+      pagedir_set_accessed (pd, p->upage, false);
+    }
+  return f->age;
+}
+
+/* Reclaim thread.  Ages every frame each AGE_INTERVAL and, if
+   the user pool is running low, evicts cold frames to refill
+   it. */
+static void
+reclaim (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct list_elem *e;
+
+      timer_sleep (AGE_INTERVAL);
+
+      lock_acquire (&frame_lock);
+      for (e = list_begin (&frames); e != list_end (&frames);
+           e = list_next (e))
+        {
+          struct frame *f = list_entry (e, struct frame, elem);
+          struct page *p = f->page;
+
+          if (lock_try_acquire (&p->lock))
+            {
+              age_frame (f);
+              lock_release (&p->lock);
+            }
+        }
+      lock_release (&frame_lock);
+
+      if (palloc_user_free_cnt () >= RECLAIM_LOW)
+        continue;
+      while (palloc_user_free_cnt () < RECLAIM_HIGH)
+        {
+          struct frame *f;
+          struct page *p;
+
+          lock_acquire (&frame_lock);
+          f = reclaim_select ();
+          lock_release (&frame_lock);
+          if (f == NULL)
+            break;
+
+          /* F stays in the frame table until its page is
+             evicted, but no one else can take it while its page
+             is locked. */
+          p = f->page;
+          if (page_evict (p))
+            frame_free (f);
+          lock_release (&p->lock);
+        }
+    }
+}
+
+/* Advances the clock hand to a frame that has gone unused for
+   all 8 aging intervals and whose page is not busy.  Returns
+   the frame with its page locked, or a null pointer if one sweep
+   finds none.  Must be called with FRAME_LOCK held. */
+static struct frame *
+reclaim_select (void)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  for (i = 0; i < frame_cnt; i++)
+    {
+      struct frame *f;
+      struct page *p;
+
+      if (hand == NULL || hand == list_end (&frames))
+        hand = list_begin (&frames);
+      f = list_entry (hand, struct frame, elem);
+      hand = list_next (hand);
+
+      p = f->page;
+      if (!lock_try_acquire (&p->lock))
+        continue;
+      if (f->age == 0
+          && !pagedir_is_accessed (p->thread->pagedir, p->upage))
+        return f;
+      lock_release (&p->lock);
+    }
+  return NULL;
+}
+
+/* Advances the clock hand to a frame whose page has not been
+   accessed since the hand last passed it or the reclaim thread
+   last aged it, aging frames along the way.  Returns the frame
+   with its page locked, or a null pointer if every page is busy.
+   Must be called with FRAME_LOCK held. */
+static struct frame *
+clock_select (void)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  /* Two full sweeps are enough to clear every accessed bit. */
+  for (i = 0; i < 2 * frame_cnt; i++)
+    {
+      struct frame *f;
+      struct page *p;
+
+      if (hand == NULL || hand == list_end (&frames))
+        hand = list_begin (&frames);
+      f = list_entry (hand, struct frame, elem);
+      hand = list_next (hand);
+
+      /* Skip pages that are being loaded, evicted, or freed. */
+      p = f->page;
+      if (!lock_try_acquire (&p->lock))
+        continue;
+
+      if ((f->age & AGE_RECENT) != 0
+          || pagedir_is_accessed (p->thread->pagedir, p->upage))
+        {
+          age_frame (f);
+          lock_release (&p->lock);
+          continue;
+        }
+      return f;
+    }
+  return NULL;
+}
@@ -0,0 +1,26 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <list.h>
+#include <stdint.h>
+
+struct page;
+struct thread;
+
+/* A user pool frame that holds a page of some process. */
+struct frame
+  {
+    void *kpage;                /* Kernel virtual address. */
+    struct page *page;          /* Page occupying this frame. */
+    uint8_t age;                /* Aging counter; see age_frame(). */
+    struct list_elem elem;      /* Element in frame table. */
+  };
+
+void frame_init (void);
+struct frame *frame_alloc (struct page *);
+void frame_free (struct frame *);
+bool frame_reserve (size_t page_cnt);
+void frame_unreserve (size_t page_cnt);
+size_t frame_working_set (struct thread *);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,132 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+
+/* Memory-mapped files.
+
+   A mapping only adds pages to the supplemental page table.
+   Each page is read straight from the file into its frame the
+   first time it is touched, without passing through a kernel
+   buffer the way read() does.  Modified pages are written back
+   to the file, never to swap, when they are evicted, unmapped,
+   or the process exits.  The page table's dirty bits tell us
+   which pages were modified. */
+
+static void unmap (struct mapping *);
+
+/* Maps FILE into the current process's address space starting
+   at ADDR.  Returns the new mapping's identifier, or MAP_FAILED
+   if ADDR is not page-aligned, FILE is empty, or the mapping
+   would overlap pages already in use. */
+mapid_t
+mmap_map (struct file *file, void *addr)
+{
+  struct thread *t = thread_current ();
+  struct mapping *m;
+  off_t length;
+  size_t i;
+
+  if (addr == NULL || pg_ofs (addr) != 0)
+    return MAP_FAILED;
+  length = file_length (file);
+  if (length <= 0)
+    return MAP_FAILED;
+  if ((uint8_t *) addr + length > STACK_BOTTOM
+      || (uint8_t *) addr + length < (uint8_t *) addr)
+    return MAP_FAILED;
+
+  /* Heap pages have no page table entries until touched, so
+     check for overlap with the heap explicitly.  The stack is
+     kept clear by the check against STACK_BOTTOM above. */
+  if ((uint8_t *) addr < (uint8_t *) pg_round_up (t->brk)
+      && (uint8_t *) addr + length > t->heap_base)
+    return MAP_FAILED;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return MAP_FAILED;
+  m->file = file_reopen (file);
+  if (m->file == NULL)
+    {
+      free (m);
+      return MAP_FAILED;
+    }
+  m->id = t->next_mapid++;
+  m->addr = addr;
+  m->page_cnt = 0;
+
+  for (i = 0; i < (size_t) DIV_ROUND_UP (length, PGSIZE); i++)
+    {
+      off_t ofs = i * PGSIZE;
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+      struct page *p = page_add_file ((uint8_t *) addr + ofs, m->file, ofs,
+                                      read_bytes, true);
+      if (p == NULL)
+        {
+          unmap (m);
+          return MAP_FAILED;
+        }
+      p->mapped = true;
+      m->page_cnt++;
+    }
+
+  list_push_back (&t->mappings, &m->elem);
+  return m->id;
+}
+
+/* Unmaps mapping MAPID of the current process, writing back any
+   modified pages.  Does nothing if there is no such mapping. */
+void
+mmap_unmap (mapid_t mapid)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&t->mappings); e != list_end (&t->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->id == mapid)
+        {
+          list_remove (&m->elem);
+          unmap (m);
+          return;
+        }
+    }
+}
+
+/* Unmaps all of the current process's mappings. */
+void
+mmap_unmap_all (void)
+{
+  struct thread *t = thread_current ();
+
+  while (!list_empty (&t->mappings))
+    {
+      struct list_elem *e = list_pop_front (&t->mappings);
+      unmap (list_entry (e, struct mapping, elem));
+    }
+}
+
+/* Removes the pages of mapping M, writing back modified ones,
+   then closes its file and frees M.  The TLB is flushed once
+   for the whole mapping. */
+static void
+unmap (struct mapping *m)
+{
+  struct pagedir_batch batch;
+  size_t i;
+
+  pagedir_batch_init (&batch, thread_current ()->pagedir);
+  for (i = 0; i < m->page_cnt; i++)
+    page_remove (page_lookup ((uint8_t *) m->addr + i * PGSIZE), &batch);
+  pagedir_batch_flush (&batch);
+  file_close (m->file);
+  free (m);
+}
@@ -0,0 +1,496 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <round.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/share.h"
+
+/* Supplemental page table.
+
+   Executables are no longer read into memory by load().
+   Instead, load() records a `struct page' for every page of
+   every loadable segment, and the page fault handler calls
+   page_fault_in() to read a page the first time it is touched.
+   Pages that are never touched are never read.
+
+   When memory runs short, the frame table evicts pages through
+   page_evict().  Clean pages are simply dropped and re-read
+   later; dirty and anonymous pages are written to swap and
+   become PAGE_ANON.
+
+   Read-only file pages are mapped from the shared text table
+   when possible, so that processes running the same program
+   share one copy of its code.
+
+   The stack grows down on demand as far as STACK_BOTTOM, and
+   may map several pages per fault; see stack_grow().
+
+   The heap, between the thread's HEAP_BASE and BRK, has no
+   entries until its pages are touched, so growing it with
+   sbrk() costs nothing but a reservation with the frame
+   table. */
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_destroy;
+static bool page_in (struct page *);
+static void page_free (struct page *, struct pagedir_batch *);
+static void page_write_back (struct page *);
+static bool stack_grow (const void *fault_addr);
+
+/* Initializes supplemental page table PAGES.
+   Returns true if successful, false on memory allocation
+   failure. */
+bool
+page_table_init (struct hash *pages)
+{
+  return hash_init (pages, page_hash, page_less, NULL);
+}
+
+/* Frees every page in PAGES, including any frames they own.
+   The pages' mappings are removed with a single TLB flush. */
+void
+page_table_destroy (struct hash *pages)
+{
+  struct thread *t = thread_current ();
+  struct pagedir_batch batch;
+
+  ASSERT (pages == &t->pages);
+
+  frame_unreserve ((ROUND_UP ((uintptr_t) t->brk, PGSIZE)
+                    - (uintptr_t) t->heap_base) / PGSIZE);
+
+  /* page_destroy() receives the hash table's auxiliary data. */
+  pagedir_batch_init (&batch, t->pagedir);
+  pages->aux = &batch;
+  hash_destroy (pages, page_destroy);
+  pagedir_batch_flush (&batch);
+}
+
+/* Adds a page to the current process's page table at UPAGE, to
+   be initialized from READ_BYTES bytes of FILE starting at OFS,
+   with the rest of the page zeroed.  If READ_BYTES is 0, the
+   page is simply zero-filled.
+   Returns the new page, or a null pointer if UPAGE is already
+   in use or memory allocation fails. */
+struct page *
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+
+  p->upage = upage;
+  p->thread = t;
+  p->type = read_bytes > 0 ? PAGE_FILE : PAGE_ZERO;
+  p->writable = writable;
+  lock_init (&p->lock);
+  p->frame = NULL;
+  p->shared = NULL;
+  p->file = file;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  p->mapped = false;
+  p->swap_slot = SWAP_ERROR;
+
+  if (hash_insert (&t->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Adds a zero-filled page to the current process's page table
+   at UPAGE.  Returns the new page, or a null pointer if UPAGE
+   is already in use or memory allocation fails. */
+struct page *
+page_add_zero (void *upage, bool writable)
+{
+  return page_add_file (upage, NULL, 0, 0, writable);
+}
+
+/* Returns the page in the current process's page table that
+   contains user virtual address UADDR, or a null pointer if
+   there is none. */
+struct page *
+page_lookup (const void *uaddr)
+{
+  struct thread *t = thread_current ();
+  struct page p;
+  struct hash_elem *e;
+
+  /* Kernel threads have no page table. */
+  if (t->pagedir == NULL)
+    return NULL;
+
+  p.upage = pg_round_down (uaddr);
+  e = hash_find (&t->pages, &p.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Makes page P resident, if it is not already.
+   Returns true if successful, false on memory allocation or
+   file read failure. */
+bool
+page_load (struct page *p)
+{
+  bool success = true;
+
+  lock_acquire (&p->lock);
+  if (p->frame == NULL && p->shared == NULL)
+    success = page_in (p);
+  lock_release (&p->lock);
+  return success;
+}
+
+/* Attempts to make the page containing FAULT_ADDR resident in
+   the current process.  Returns true if successful, false if
+   FAULT_ADDR is not part of the process's address space or the
+   page cannot be loaded.  ESP is the user stack pointer at the
+   time of the fault; an access at most 32 bytes below it (as
+   made by PUSHA) grows the stack. */
+bool
+page_fault_in (const void *fault_addr, const void *esp)
+{
+  struct page *p;
+
+  if (!is_user_vaddr (fault_addr))
+    return false;
+
+  p = page_lookup (fault_addr);
+  if (p == NULL)
+    {
+      if (page_in_heap (fault_addr))
+        p = page_add_zero (pg_round_down (fault_addr), true);
+      else if ((const uint8_t *) fault_addr >= STACK_BOTTOM
+               && (const uint8_t *) fault_addr + 32 >= (const uint8_t *) esp)
+        return stack_grow (fault_addr);
+    }
+  return p != NULL && page_load (p);
+}
+
+/* Maps the first page of the current process's stack, just
+   below PHYS_BASE.  Returns true if successful. */
+bool
+page_add_stack (void)
+{
+  struct thread *t = thread_current ();
+  struct page *p = page_add_zero ((uint8_t *) PHYS_BASE - PGSIZE, true);
+
+  if (p == NULL || !page_load (p))
+    return false;
+  t->stack_low = p->upage;
+  t->stack_ahead = 1;
+  return true;
+}
+
+/* Grows the current process's stack to cover FAULT_ADDR.
+
+   A fault on the page just below the lowest stack page means
+   the stack is growing steadily, as in a deep recursion, so each
+   such fault maps twice as many pages as the one before, up to
+   STACK_AHEAD_MAX.  Any other fault maps just the one page.
+   Returns true if the faulting page was mapped. */
+static bool
+stack_grow (const void *fault_addr)
+{
+  struct thread *t = thread_current ();
+  uint8_t *upage = pg_round_down (fault_addr);
+  uint8_t *low;
+  int i;
+
+  if (upage + PGSIZE == t->stack_low)
+    t->stack_ahead = (t->stack_ahead * 2 < STACK_AHEAD_MAX
+                      ? t->stack_ahead * 2 : STACK_AHEAD_MAX);
+  else
+    t->stack_ahead = 1;
+
+  low = upage + PGSIZE;
+  for (i = 0; i < t->stack_ahead; i++)
+    {
+      uint8_t *addr = upage - i * PGSIZE;
+      struct page *p;
+
+      if (addr < STACK_BOTTOM || page_lookup (addr) != NULL)
+        break;
+      p = page_add_zero (addr, true);
+      if (p == NULL)
+        break;
+      low = addr;
+
+      /* Only the faulting page has to be loaded; the others
+         are loaded ahead of time if memory allows. */
+      if (!page_load (p) && i == 0)
+        return false;
+    }
+  if (low > upage)
+    return false;
+
+  if (low < t->stack_low)
+    t->stack_low = low;
+  return true;
+}
+
+/* Returns true if UADDR is within the current process's heap. */
+bool
+page_in_heap (const void *uaddr)
+{
+  struct thread *t = thread_current ();
+  return (const uint8_t *) uaddr >= t->heap_base
+         && (const uint8_t *) uaddr < t->brk;
+}
+
+/* Moves the current process's program break by INCREMENT bytes,
+   which may be negative.  New heap pages are only reserved; they
+   are created zeroed when first touched.  Pages that fall
+   entirely above the new break are freed.
+   Returns the old break, or (void *) -1 if the break would move
+   below the start of the heap, into other pages, or past the
+   memory available. */
+void *
+page_sbrk (intptr_t increment)
+{
+  struct thread *t = thread_current ();
+  uintptr_t brk = (uintptr_t) t->brk;
+  uintptr_t new_brk = brk + increment;
+  uintptr_t top = ROUND_UP (brk, PGSIZE);
+  uintptr_t new_top;
+
+  if ((increment > 0 && new_brk < brk)
+      || (increment < 0 && new_brk > brk)
+      || new_brk < (uintptr_t) t->heap_base
+      || new_brk > (uintptr_t) STACK_BOTTOM)
+    return (void *) -1;
+  new_top = ROUND_UP (new_brk, PGSIZE);
+
+  if (new_top > top)
+    {
+      size_t page_cnt = (new_top - top) / PGSIZE;
+      uintptr_t upage;
+
+      if (!frame_reserve (page_cnt))
+        return (void *) -1;
+      for (upage = top; upage < new_top; upage += PGSIZE)
+        if (page_lookup ((void *) upage) != NULL)
+          {
+            frame_unreserve (page_cnt);
+            return (void *) -1;
+          }
+    }
+  else if (new_top < top)
+    {
+      struct pagedir_batch batch;
+      uintptr_t upage;
+
+      pagedir_batch_init (&batch, t->pagedir);
+      for (upage = new_top; upage < top; upage += PGSIZE)
+        {
+          struct page *p = page_lookup ((void *) upage);
+          if (p != NULL)
+            page_remove (p, &batch);
+        }
+      pagedir_batch_flush (&batch);
+      frame_unreserve ((top - new_top) / PGSIZE);
+    }
+
+  t->brk = (uint8_t *) new_brk;
+  return (void *) brk;
+}
+
+/* Evicts page P, which must be resident and locked by the
+   caller, from its frame.  A page that is dirty or anonymous is
+   written to swap first, except that a dirty memory-mapped page
+   is written back to its file; a clean page is dropped.
+   Returns true if successful, false if swap is full, in which
+   case P stays resident. */
+bool
+page_evict (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+  bool dirty;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (p->frame != NULL);
+
+  /* Unmap first, so that the dirty bit cannot change after we
+     read it. */
+  pagedir_clear_page (pd, p->upage);
+  dirty = pagedir_is_dirty (pd, p->upage);
+
+  if (p->mapped)
+    {
+      if (dirty)
+        page_write_back (p);
+    }
+  else if (dirty || p->type == PAGE_ANON)
+    {
+      swap_slot_t slot = swap_out (p->frame->kpage);
+      if (slot == SWAP_ERROR)
+        {
+          pagedir_set_page (pd, p->upage, p->frame->kpage, p->writable);
+          pagedir_set_dirty (pd, p->upage, dirty);
+          return false;
+        }
+      p->type = PAGE_ANON;
+      p->swap_slot = slot;
+    }
+  p->frame = NULL;
+  return true;
+}
+
+/* Removes page P from its owner's page table and frees it,
+   writing it back to its file first if it is a modified
+   memory-mapped page.  P must belong to the current process.
+   Its mapping is cleared as part of BATCH, which the caller
+   must flush. */
+void
+page_remove (struct page *p, struct pagedir_batch *batch)
+{
+  ASSERT (p->thread == thread_current ());
+
+  hash_delete (&p->thread->pages, &p->hash_elem);
+  page_free (p, batch);
+}
+
+/* Obtains a frame for page P, which must be locked by the
+   caller, fills it in, and maps it into the owning process's
+   page directory.
+   Returns true if successful, false on failure. */
+static bool
+page_in (struct page *p)
+{
+  struct frame *f;
+  uint8_t *kpage;
+
+  ASSERT (p->frame == NULL && p->shared == NULL);
+
+  /* Map read-only code from the shared text table.  Fall back to
+     a private copy if that fails. */
+  if (p->type == PAGE_FILE && !p->writable)
+    {
+      struct shared_text *s = share_get (p->file, p->file_ofs, p->read_bytes);
+      if (s != NULL)
+        {
+          if (!pagedir_set_page (p->thread->pagedir, p->upage, s->kpage,
+                                 false))
+            {
+              share_put (s);
+              return false;
+            }
+          p->shared = s;
+          return true;
+        }
+    }
+
+  f = frame_alloc (p);
+  if (f == NULL)
+    return false;
+  kpage = f->kpage;
+
+  switch (p->type)
+    {
+    case PAGE_FILE:
+      if (file_read_at (p->file, kpage, p->read_bytes, p->file_ofs)
+          != (off_t) p->read_bytes)
+        {
+          frame_free (f);
+          return false;
+        }
+      memset (kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+      break;
+
+    case PAGE_ZERO:
+      memset (kpage, 0, PGSIZE);
+      break;
+
+    case PAGE_ANON:
+      swap_in (p->swap_slot, kpage);
+      p->swap_slot = SWAP_ERROR;
+      break;
+
+    default:
+      NOT_REACHED ();
+    }
+
+  if (!pagedir_set_page (p->thread->pagedir, p->upage, kpage, p->writable))
+    {
+      frame_free (f);
+      return false;
+    }
+  p->frame = f;
+  return true;
+}
+
+/* Returns a hash value for the page that E refers to. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+  return a->upage < b->upage;
+}
+
+/* Frees the page that E refers to, as part of batch AUX. */
+static void
+page_destroy (struct hash_elem *e, void *aux)
+{
+  page_free (hash_entry (e, struct page, hash_elem), aux);
+}
+
+/* Unmaps page P, writes it back if it is a modified mapped page,
+   releases its frame, shared text page, or swap slot, and frees
+   P itself.  The mapping is cleared as part of BATCH. */
+static void
+page_free (struct page *p, struct pagedir_batch *batch)
+{
+  lock_acquire (&p->lock);
+  if (p->frame != NULL)
+    {
+      uint32_t *pd = p->thread->pagedir;
+
+      pagedir_batch_clear_page (batch, p->upage);
+      if (p->mapped && pagedir_is_dirty (pd, p->upage))
+        page_write_back (p);
+      frame_free (p->frame);
+    }
+  else if (p->shared != NULL)
+    {
+      pagedir_batch_clear_page (batch, p->upage);
+      share_put (p->shared);
+    }
+  else if (p->swap_slot != SWAP_ERROR)
+    swap_free (p->swap_slot);
+  lock_release (&p->lock);
+  free (p);
+}
+
+/* Writes the contents of memory-mapped page P, which must be
+   resident and locked, back to its file. */
+static void
+page_write_back (struct page *p)
+{
+  ASSERT (p->mapped && p->frame != NULL);
+  file_write_at (p->file, p->frame->kpage, p->read_bytes, p->file_ofs);
+}
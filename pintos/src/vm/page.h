@@ -0,0 +1,83 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/swap.h"
+
+struct file;
+struct frame;
+struct pagedir_batch;
+struct shared_text;
+struct thread;
+
+/* Maximum size of a process's stack, and the lowest address
+   the stack may grow down to.  The heap and memory mappings
+   must stay below STACK_BOTTOM. */
+#define STACK_MAX (8 * 1024 * 1024)
+#define STACK_BOTTOM ((uint8_t *) PHYS_BASE - STACK_MAX)
+
+/* Most pages mapped by one stack growth fault. */
+#define STACK_AHEAD_MAX 16
+
+/* Where the contents of a page come from the next time it is
+   faulted in. */
+enum page_type
+  {
+    PAGE_FILE,                  /* Read from a file, zero the rest. */
+    PAGE_ZERO,                  /* All zeros. */
+    PAGE_ANON                   /* Anonymous, saved to swap on eviction. */
+  };
+
+/* Supplemental page table entry.
+
+   Each user process keeps one of these for every page of its
+   address space, whether or not the page currently has a frame.
+   The page directory only describes pages that are resident;
+   this table describes how to make a page resident.
+
+   LOCK is held while the page is being loaded, evicted, or
+   destroyed, so that these never overlap. */
+struct page
+  {
+    void *upage;                /* User virtual address. */
+    struct thread *thread;      /* Owning thread. */
+    enum page_type type;        /* Backing store type. */
+    bool writable;              /* Writable by user process? */
+    struct lock lock;           /* Serializes load and eviction. */
+    struct frame *frame;        /* Frame holding the page, or NULL. */
+    struct shared_text *shared; /* Shared text page mapped, or NULL. */
+
+    /* For PAGE_FILE. */
+    struct file *file;          /* File to read from. */
+    off_t file_ofs;             /* Offset in FILE. */
+    size_t read_bytes;          /* Bytes to read; rest are zeroed. */
+    bool mapped;                /* Memory-mapped: write back to FILE. */
+
+    /* For PAGE_ANON. */
+    swap_slot_t swap_slot;      /* Swap slot, if not resident. */
+
+    struct hash_elem hash_elem; /* Element in thread's page table. */
+  };
+
+bool page_table_init (struct hash *);
+void page_table_destroy (struct hash *);
+
+struct page *page_add_file (void *upage, struct file *, off_t ofs,
+                            size_t read_bytes, bool writable);
+struct page *page_add_zero (void *upage, bool writable);
+struct page *page_lookup (const void *uaddr);
+bool page_load (struct page *);
+bool page_fault_in (const void *fault_addr, const void *esp);
+bool page_add_stack (void);
+bool page_evict (struct page *);
+void page_remove (struct page *, struct pagedir_batch *);
+void *page_sbrk (intptr_t increment);
+bool page_in_heap (const void *uaddr);
+
+#endif /* vm/page.h */
@@ -0,0 +1,155 @@
+#include "vm/share.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Shared text pages.
+
+   Read-only pages of executables are kept in a table keyed by
+   (inode, page offset) with reference counts, so that N
+   processes running the same program map a single copy of its
+   code and only the first of them reads it from disk.
+
+   Shared frames come straight from the user pool and are not
+   in the frame table, so they are never evicted while mapped.
+   A page is released when its last mapping goes away.  Keeping
+   unmapped pages around would require invalidating them when
+   the executable is later written. */
+
+/* Table of shared text pages. */
+static struct hash shared_texts;
+
+/* Protects SHARED_TEXTS and each entry's REF_CNT. */
+static struct lock share_lock;
+
+static hash_hash_func shared_text_hash;
+static hash_less_func shared_text_less;
+
+/* Initializes the shared text table. */
+void
+share_init (void)
+{
+  if (!hash_init (&shared_texts, shared_text_hash, shared_text_less, NULL))
+    PANIC ("share: cannot allocate shared text table");
+  lock_init (&share_lock);
+}
+
+/* Returns the shared copy of the page at offset OFS in FILE,
+   whose first READ_BYTES bytes come from FILE and the rest are
+   zero, reading it in if no process has it yet.  The caller
+   must release it with share_put().
+   Returns a null pointer if the page cannot be shared, in which
+   case the caller should load a private copy. */
+struct shared_text *
+share_get (struct file *file, off_t ofs, size_t read_bytes)
+{
+  struct shared_text key, *s;
+  struct hash_elem *e;
+  uint8_t *kpage;
+
+  ASSERT (ofs % PGSIZE == 0);
+  ASSERT (read_bytes <= PGSIZE);
+
+  key.inode = file_get_inode (file);
+  key.ofs = ofs;
+
+  lock_acquire (&share_lock);
+  e = hash_find (&shared_texts, &key.hash_elem);
+  if (e != NULL)
+    {
+      /* Wait for whoever is reading the page to finish. */
+      s = hash_entry (e, struct shared_text, hash_elem);
+      s->ref_cnt++;
+      lock_release (&share_lock);
+
+      lock_acquire (&s->load_lock);
+      lock_release (&s->load_lock);
+    }
+  else
+    {
+      s = malloc (sizeof *s);
+      kpage = palloc_get_page (PAL_USER);
+      if (s == NULL || kpage == NULL)
+        {
+          lock_release (&share_lock);
+          free (s);
+          palloc_free_page (kpage);
+          return NULL;
+        }
+      s->inode = inode_reopen (key.inode);
+      s->ofs = ofs;
+      s->kpage = NULL;
+      s->ref_cnt = 1;
+      lock_init (&s->load_lock);
+      lock_acquire (&s->load_lock);
+      hash_insert (&shared_texts, &s->hash_elem);
+      lock_release (&share_lock);
+
+      /* Read the page without holding SHARE_LOCK. */
+      if (inode_read_at (s->inode, kpage, read_bytes, ofs)
+          == (off_t) read_bytes)
+        {
+          memset (kpage + read_bytes, 0, PGSIZE - read_bytes);
+          s->kpage = kpage;
+        }
+      else
+        palloc_free_page (kpage);
+      lock_release (&s->load_lock);
+    }
+
+  if (s->kpage == NULL)
+    {
+      share_put (s);
+      return NULL;
+    }
+  return s;
+}
+
+/* Drops a reference to S, freeing it along with its frame when
+   the last reference goes away.  S must already be unmapped
+   from the caller's page directory. */
+void
+share_put (struct shared_text *s)
+{
+  bool last;
+
+  lock_acquire (&share_lock);
+  ASSERT (s->ref_cnt > 0);
+  last = --s->ref_cnt == 0;
+  if (last)
+    hash_delete (&shared_texts, &s->hash_elem);
+  lock_release (&share_lock);
+
+  if (last)
+    {
+      if (s->kpage != NULL)
+        palloc_free_page (s->kpage);
+      inode_close (s->inode);
+      free (s);
+    }
+}
+
+/* Returns a hash value for the shared text page E. */
+static unsigned
+shared_text_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct shared_text *s = hash_entry (e, struct shared_text, hash_elem);
+  return hash_bytes (&s->inode, sizeof s->inode) ^ hash_int (s->ofs);
+}
+
+/* Returns true if shared text page A precedes page B. */
+static bool
+shared_text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                  void *aux UNUSED)
+{
+  const struct shared_text *a = hash_entry (a_, struct shared_text, hash_elem);
+  const struct shared_text *b = hash_entry (b_, struct shared_text, hash_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  return a->ofs < b->ofs;
+}
@@ -0,0 +1,26 @@
+#ifndef VM_SHARE_H
+#define VM_SHARE_H
+
+#include <hash.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct file;
+
+/* A read-only page of an executable, shared by every process
+   that maps the same page of the same file. */
+struct shared_text
+  {
+    struct inode *inode;        /* Executable's inode. */
+    off_t ofs;                  /* Page-aligned offset in INODE. */
+    void *kpage;                /* Frame, or NULL if loading failed. */
+    int ref_cnt;                /* Number of mappings. */
+    struct lock load_lock;      /* Held while KPAGE is being read. */
+    struct hash_elem hash_elem; /* Element in shared text table. */
+  };
+
+void share_init (void);
+struct shared_text *share_get (struct file *, off_t ofs, size_t read_bytes);
+void share_put (struct shared_text *);
+
+#endif /* vm/share.h */
@@ -0,0 +1,87 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Number of sectors in a swap slot. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Swap device, or a null pointer if there is none. */
+static struct block *swap_device;
+
+/* Used swap slots, one bit per slot. */
+static struct bitmap *swap_map;
+static struct lock swap_lock;
+
+/* Initializes the swap slot map for the BLOCK_SWAP device.
+   Without a swap device, every swap_out() fails. */
+void
+swap_init (void)
+{
+  size_t slot_cnt = 0;
+
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device != NULL)
+    slot_cnt = block_size (swap_device) / PAGE_SECTORS;
+  else
+    printf ("swap: no swap device, anonymous pages cannot be evicted\n");
+
+  swap_map = bitmap_create (slot_cnt);
+  if (swap_map == NULL)
+    PANIC ("swap: cannot allocate slot map");
+  lock_init (&swap_lock);
+}
+
+/* Writes the page at KPAGE to a free swap slot and returns the
+   slot, or SWAP_ERROR if swap is full. */
+swap_slot_t
+swap_out (const void *kpage)
+{
+  struct block_iovec iov;
+  swap_slot_t slot;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (swap_map, 0, 1, false);
+  lock_release (&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return SWAP_ERROR;
+
+  iov.buffer = (void *) kpage;
+  iov.sector_cnt = PAGE_SECTORS;
+  block_write_multi (swap_device, slot * PAGE_SECTORS, &iov, 1);
+  return slot;
+}
+
+/* Reads swap slot SLOT into KPAGE and frees the slot. */
+void
+swap_in (swap_slot_t slot, void *kpage)
+{
+  struct block_iovec iov;
+
+  ASSERT (bitmap_test (swap_map, slot));
+
+  iov.buffer = kpage;
+  iov.sector_cnt = PAGE_SECTORS;
+  block_read_multi (swap_device, slot * PAGE_SECTORS, &iov, 1);
+  swap_free (slot);
+}
+
+/* Returns the number of slots on the swap device. */
+size_t
+swap_slot_cnt (void)
+{
+  return bitmap_size (swap_map);
+}
+
+/* Releases swap slot SLOT without reading it. */
+void
+swap_free (swap_slot_t slot)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (swap_map, slot));
+  bitmap_reset (swap_map, slot);
+  lock_release (&swap_lock);
+}
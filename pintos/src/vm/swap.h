@@ -0,0 +1,16 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stddef.h>
+
+/* Index of a page-sized slot on the swap device. */
+typedef size_t swap_slot_t;
+#define SWAP_ERROR ((swap_slot_t) -1)
+
+void swap_init (void);
+swap_slot_t swap_out (const void *kpage);
+void swap_in (swap_slot_t, void *kpage);
+void swap_free (swap_slot_t);
+size_t swap_slot_cnt (void);
+
+#endif /* vm/swap.h */